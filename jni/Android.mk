@@ -16,6 +16,7 @@ CORE_SOURCES := \
 	ivoice.c \
 	psg.c \
 	stic.c \
+	profile.c \
 	stb_image_impl.c
 
 # libretro-common sources
@@ -46,6 +47,6 @@ include $(CLEAR_VARS)
 LOCAL_MODULE            := retro_freeintvds
 LOCAL_SRC_FILES         := $(LOCAL_SRC_FILES)
 LOCAL_C_INCLUDES        := $(SRC_DIR) $(LIBRETRO_DIR)/include
-LOCAL_CFLAGS            := -DANDROID -D__LIBRETRO__ -DHAVE_STRINGS_H -DRIGHTSHIFT_IS_SAR -DFREEINTV_DS -DDEBUG_ANDROID
+LOCAL_CFLAGS            := -DANDROID -D__LIBRETRO__ -DHAVE_STRINGS_H -DRIGHTSHIFT_IS_SAR -DFREEINTV_DS -DFREEINTV_THREADS -DDEBUG_ANDROID
 LOCAL_LDFLAGS           := -Wl,-version-script=$(CORE_DIR)/link.T
 include $(BUILD_SHARED_LIBRARY)
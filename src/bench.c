@@ -0,0 +1,182 @@
+/*
+	This file is part of FreeIntv.
+
+	FreeIntv is free software; you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation; either version 2 of the License, or
+	(at your option) any later version.
+
+	FreeIntv is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License along
+	with FreeIntv; if not, write to the Free Software Foundation, Inc.,
+	51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+// Headless benchmark runner (make bench)
+//
+// Runs the core without a libretro frontend, display or audio device:
+//   freeintvds_bench [-n frames] [-i input.txt] [-r] exec.bin grom.bin game.rom
+//
+// -r draws each card row at its STIC phase ("Per Card Row" rendering).
+//
+// The input script has one "frame player state" line per change, state is
+// the controller byte in hex as returned by getControllerState (0 = idle),
+// for example "120 0 0x60" holds a side button on the right controller from
+// frame 120 on.  Lines starting with # are ignored.
+//
+// make bench always builds the core it links with FREEINTV_PROFILE, the
+// profiling hooks time the STIC (whole frames and card rows), PSG and
+// Intellivoice; cpu time is what's left of the emulation time.  It also
+// prints the profiling report (opcode histogram, memory accesses).
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "intv.h"
+#include "memory.h"
+#include "cp1610.h"
+#include "stic.h"
+#include "psg.h"
+#include "controller.h"
+#include "osd.h"
+#include "ivoice.h"
+#include "profile.h"
+
+#define BENCH_MAX_INPUTS 4096
+
+struct BenchInput {
+	int frame;
+	int player;
+	int state;
+};
+
+struct BenchInput Inputs[BENCH_MAX_INPUTS];
+int InputCount = 0;
+
+double now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+int64_t ProfileMicroseconds(void)
+{
+	return (int64_t)(now() * 1000000.0);
+}
+
+void ProfilePrint(const char *line)
+{
+	printf("%s\n", line);
+}
+
+int loadInputs(const char *path)
+{
+	char line[256];
+	FILE *fp;
+
+	if((fp = fopen(path, "r"))==NULL)
+	{
+		printf("[ERROR] [FREEINTV] Failed loading input script from: %s\n", path);
+		return 0;
+	}
+	while(fgets(line, sizeof(line), fp)!=NULL && InputCount<BENCH_MAX_INPUTS)
+	{
+		struct BenchInput *in = &Inputs[InputCount];
+		if(line[0]=='#') { continue; }
+		if(sscanf(line, "%d %d %i", &in->frame, &in->player, &in->state)==3)
+		{
+			InputCount++;
+		}
+	}
+	fclose(fp);
+	return 1;
+}
+
+void usage(void)
+{
+	printf("usage: freeintvds_bench [-n frames] [-i input.txt] [-r] exec.bin grom.bin game.rom\n");
+}
+
+int main(int argc, char *argv[])
+{
+	static unsigned int display[352*224]; // OSD target, the frontend's copy of frame
+	int frames = 3600;
+	const char *inputPath = NULL;
+	int i, f, next;
+	unsigned int clock, instructions;
+	double cycles = 0.0;
+	double count = 0.0;
+	double start, total, stic, psg, ivoice;
+
+	for(i=1; i<argc-3; i++)
+	{
+		if(strcmp(argv[i], "-n")==0 && i+1<argc-3) { frames = atoi(argv[++i]); }
+		else if(strcmp(argv[i], "-i")==0 && i+1<argc-3) { inputPath = argv[++i]; }
+		else if(strcmp(argv[i], "-r")==0) { STICIncremental = 1; }
+		else { usage(); return 1; }
+	}
+	if(argc<4 || frames<1) { usage(); return 1; }
+	if(inputPath!=NULL && !loadInputs(inputPath)) { return 1; }
+
+	OSD_setDisplay(display, 352, 224);
+	controllerInit();
+	Init();
+	Reset();
+	loadExec(argv[argc-3]);
+	loadGrom(argv[argc-2]);
+	LoadGame(argv[argc-1]);
+
+	ProfileTimer = ProfileMicroseconds;
+	ProfileEnabled = 1;
+	ProfileReset();
+
+	next = 0;
+	start = now();
+	for(f=0; f<frames; f++)
+	{
+		while(next<InputCount && Inputs[next].frame<=f)
+		{
+			setControllerInput(Inputs[next].player & 1, Inputs[next].state);
+			next++;
+		}
+
+		clock = CP1610Clock;
+		instructions = CP1610Instructions;
+		Run();
+		cycles += (unsigned int)(CP1610Clock - clock);
+		count += (unsigned int)(CP1610Instructions - instructions);
+
+		// what retro_run does with the audio buffers once the frame is done
+		PSGFrame();
+		ivoice_frame();
+
+		if(intv_halt)
+		{
+			printf("[ERROR] [FREEINTV] cpu halted at frame %d\n", f);
+			frames = f+1;
+			break;
+		}
+	}
+	total = now() - start;
+	stic = ProfileTime[PROFILE_STIC] / 1e6;
+	psg = ProfileTime[PROFILE_PSG] / 1e6;
+	ivoice = ProfileTime[PROFILE_IVOICE] / 1e6;
+
+	printf("frames        %d\n", frames);
+	printf("time          %.3f s\n", total);
+	printf("frames/sec    %.1f (%.2fx real time)\n", frames / total, frames / total / 60.0);
+	printf("instr/sec     %.0f (%.0f per frame)\n", count / total, count / frames);
+	printf("cycles/sec    %.0f\n", cycles / total);
+	printf("cpu           %.3f s %5.1f%%\n", total - stic - psg - ivoice, 100.0 * (total - stic - psg - ivoice) / total);
+	printf("stic          %.3f s %5.1f%%\n", stic, 100.0 * stic / total);
+	printf("psg           %.3f s %5.1f%%\n", psg, 100.0 * psg / total);
+	printf("intellivoice  %.3f s %5.1f%%\n", ivoice, 100.0 * ivoice / total);
+	ProfileReport(ProfilePrint, frames);
+	return 0;
+}
@@ -20,15 +20,44 @@
 #include "intv.h"
 #include "memory.h"
 #include "cp1610.h"
+#include "profile.h"
 
 // http://wiki.intellivision.us/index.php?title=CP1610#Instruction_Set
 // http://spatula-city.org/~im14u2c/chips/GICP1600.pdf
 // ftp://bitsavers.informatik.uni-stuttgart.de/components/gi/CP1600/CP-1600_Microprocessor_Users_Manual_May75.pdf
 
 int (*OpCodes[0x400])(int);
+int (*OpCodesSDBD[0x400])(int); // handlers for the instruction following SDBD
 int Interuptable[0x400];
+int Operands[0x400]; // operand words following the opcode that are decoded ahead of time
 const char *Nmemonic[0x400];
 
+// Predecoded instruction cache, indexed by address.  Entries are only
+// valid while generation matches DecodeGeneration; writeMem invalidates
+// the entries covering a written word so self-modifying code still works.
+struct CP1610Decoded {
+	int (*handler)(int);
+	unsigned int instruction;
+	unsigned int generation;
+	unsigned short operand; // first operand word (address, branch offset, immediate, or Jump decle 2)
+	unsigned short target;  // Jump destination address
+	unsigned char interuptable;
+};
+
+struct CP1610Decoded DecodeCache[0x10000];
+struct CP1610Decoded DecodeScratch; // used for addresses that can't be cached
+unsigned int DecodeGeneration = 1;
+
+const struct CP1610Decoded *Decoded; // instruction being executed
+
+int TickDefault(void);
+int TickSDBD(void);
+int (*Tick)(void) = TickDefault; // TickSDBD for the one instruction after SDBD
+
+#ifdef CP1610_THREADED
+void CP1610ThreadedInit(void);
+#endif
+
 unsigned int R[8] = {0, 0, 0, 0, 0, 0, 0x02F1, 0x1000}; // Registers R0-R7
 
 const int PC = 7; // const Program Counter (R7)
@@ -36,6 +65,12 @@ const int SP = 6; // const Stack Pointer (R6)
 
 int InstructionRegister = 0; // four external lines?
 
+int CP1610Halted = 0; // set when CP1610Run stops on HLT or a bad opcode
+
+unsigned int CP1610Clock = 0; // cycles since power on, including BUSRQ stalls (wraps)
+
+unsigned int CP1610Instructions = 0; // instructions run by CP1610Run, including skipped idle passes (wraps)
+
 int Flag_DoubleByteData = 0;
 int Flag_InteruptEnable = 0;
 int Flag_Carry = 0;
@@ -43,8 +78,53 @@ int Flag_Sign = 0;
 int Flag_Zero = 0;
 int Flag_Overflow = 0;
 
+// Lazy flag mode: ALU ops only record their result (and add/subtract
+// operands), the flags are worked out when an instruction reads them.
+#ifdef CP1610_LAZY_FLAGS
+#define LAZY_ADD 1
+#define LAZY_SUB 2
+unsigned int LazySZ;   // result Sign and Zero are still to be taken from
+int LazySZPending = 0;
+int LazyA, LazyB;      // operands Carry and Overflow are still to be taken from
+int LazyCOPending = 0; // LAZY_ADD or LAZY_SUB
+
+void FlagsCO(void)
+{
+	int signa = LazyA & 0x8000;
+	int signb = LazyB & 0x8000;
+	int result;
+	int signr;
+	if(LazyCOPending==LAZY_ADD)
+	{
+		result = LazyA + LazyB;
+		signr = result & 0x8000;
+		Flag_Overflow = (signa==signb && signa!=signr) ? 1 : 0;
+	}
+	else
+	{
+		result = LazyA + (LazyB ^ 0xFFFF) + 1;
+		signr = result & 0x8000;
+		Flag_Overflow = (signa!=signb && signa!=signr) ? 1 : 0;
+	}
+	Flag_Carry = (result & 0x10000) != 0;
+	LazyCOPending = 0;
+}
+
+#define FLAGS_SZ() if(LazySZPending) { Flag_Sign = (LazySZ & 0x8000)!=0; Flag_Zero = LazySZ==0; LazySZPending = 0; }
+#define FLAGS_CO() if(LazyCOPending) { FlagsCO(); }
+#define DROP_SZ() LazySZPending = 0
+#define DROP_CO() LazyCOPending = 0
+#else
+#define FLAGS_SZ()
+#define FLAGS_CO()
+#define DROP_SZ()
+#define DROP_CO()
+#endif
+
 void CP1610Serialize(struct CP1610serialized *all)
 {
+    FLAGS_SZ();
+    FLAGS_CO();
     all->Flag_DoubleByteData = Flag_DoubleByteData;
     all->Flag_InteruptEnable = Flag_InteruptEnable;
     all->Flag_Carry = Flag_Carry;
@@ -62,7 +142,10 @@ void CP1610Unserialize(const struct CP1610serialized *all)
     Flag_Sign = all->Flag_Sign;
     Flag_Zero = all->Flag_Zero;
     Flag_Overflow = all->Flag_Overflow;
+    DROP_SZ();
+    DROP_CO();
     memcpy(&R[0], &all->R[0], sizeof(R));
+    Tick = Flag_DoubleByteData ? TickSDBD : TickDefault;
 }
 
 void CP1610Reset()
@@ -73,12 +156,74 @@ void CP1610Reset()
 	Flag_Sign = 0;
 	Flag_Zero = 0;
 	Flag_Overflow = 0;
+	DROP_SZ();
+	DROP_CO();
+	Tick = TickDefault;
 	R[0] = R[1] = R[2] = R[3] = R[4] = R[5] = 0;
 	R[SP] = 0x02F1; // Stack is at System Ram 0x02F1-0x0318
 	R[PC] = 0x1000; // EXEC entry point
 }
 
-int readIndirect(int reg) // Read Indirect, handle SDBD, update autoincriment registers
+void CP1610FlushCache(void)
+{
+	DecodeGeneration++;
+}
+
+void CP1610Invalidate(int adr)
+{
+	// an instruction is at most three words long, so a write can
+	// change the instruction at adr or the two before it
+	DecodeCache[adr & 0xFFFF].generation = 0;
+	DecodeCache[(adr-1) & 0xFFFF].generation = 0;
+	DecodeCache[(adr-2) & 0xFFFF].generation = 0;
+}
+
+int isCacheable(int adr)
+{
+	// readMem has side effects or returns volatile data for STIC registers
+	// (and their aliases), the Intellivoice, scratch ram and the PSG/controllers
+	adr &= 0xFFFF;
+	return (adr & 0x3fc0) != 0 && (adr < 0x80 || adr > 0x1FF);
+}
+
+const struct CP1610Decoded *CP1610Decode(unsigned int adr)
+{
+	struct CP1610Decoded *op = &DecodeCache[adr & 0xFFFF];
+	unsigned int instruction = readMem(adr);
+	int operands = 0;
+	int cacheable = isCacheable(adr);
+
+	if(instruction <= 0x03FF)
+	{
+		operands = Operands[instruction];
+	}
+	if(operands > 0) { cacheable &= isCacheable(adr+1); }
+	if(operands > 1) { cacheable &= isCacheable(adr+2); }
+	if(!cacheable) { op = &DecodeScratch; }
+
+	op->instruction = instruction;
+	op->handler = NULL;
+	op->interuptable = 0;
+	op->operand = 0;
+	op->target = 0;
+	if(instruction <= 0x03FF)
+	{
+		op->handler = OpCodes[instruction];
+		op->interuptable = Interuptable[instruction];
+		if(operands > 0)
+		{
+			op->operand = readMem(adr+1);
+		}
+		if(operands > 1) // Jump: 0000:00rr:aaaa:aaff  0000:00aa:aaaa:aaaa
+		{
+			op->target = (((op->operand>>2) & 0x3F)<<10) | (readMem(adr+2) & 0x3FF);
+		}
+	}
+	op->generation = cacheable ? DecodeGeneration : 0;
+	return op;
+}
+
+int readIndirect(int reg) // Read Indirect, update autoincriment registers
 {
     int val = 0;
     int adr = 0;
@@ -91,15 +236,19 @@ int readIndirect(int reg) // Read Indirect, handle SDBD, update autoincriment re
     {
         R[reg] = (R[reg]+1) & 0xFFFF;
     }
-    if(Flag_DoubleByteData == 1) {
-        val &= 0xff;
-        if(reg==4 || reg==5 || reg==7) // autoincrement registers (incremented twice for double byte data)
-        {
-            val |= ((readMem(adr+1) & 0xFF)<<8);
-            R[reg] = (R[reg]+1) & 0xFFFF;
-        } else {
-            val |= val << 8;
-        }
+    return val;
+}
+
+int readIndirectSDBD(int reg) // Read Indirect after SDBD, low byte then high byte
+{
+    int val = readIndirect(reg) & 0xff;
+
+    if(reg==4 || reg==5 || reg==7) // autoincrement registers (incremented twice for double byte data)
+    {
+        val |= ((readMem(R[reg]) & 0xFF)<<8);
+        R[reg] = (R[reg]+1) & 0xFFFF;
+    } else {
+        val |= val << 8; // the same byte twice (R0-R3, SP)
     }
     return val;
 }
@@ -116,15 +265,19 @@ void writeIndirect(int reg, int val)
 
 int readOperand(void)
 {
-	int val = readMem(R[PC]);
 	R[PC]++;
-	return val;
+	return Decoded->operand;
+}
+
+int readImmediate(void) // nnnI without SDBD, the word after the opcode
+{
+	R[PC] = (R[PC]+1) & 0xFFFF;
+	return Decoded->operand;
 }
 
 int readOperandIndirect(void)
 {
-	int adr = readMem(R[PC]);
-	int val = readMem(adr);
+	int val = readMem(Decoded->operand);
 	R[PC]++;
 	return val;
 }
@@ -132,12 +285,36 @@ int readOperandIndirect(void)
 void SetFlagsSZ(int reg)
 {
 	R[reg] = R[reg] & 0xFFFF;
+#ifdef CP1610_LAZY_FLAGS
+	LazySZ = R[reg];
+	LazySZPending = 1;
+#else
 	Flag_Sign = (R[reg] & 0x8000)!=0;
 	Flag_Zero = R[reg]==0;
+#endif
+}
+
+void SetFlagsSZResult(int res) // Sign and Zero of a result that isn't stored (CMP)
+{
+#ifdef CP1610_LAZY_FLAGS
+	LazySZ = res;
+	LazySZPending = 1;
+#else
+	Flag_Sign = (res & 0x8000)!=0;
+	Flag_Zero = res==0;
+#endif
 }
 
 int AddSetSZOC(int A, int B)
 {
+#ifdef CP1610_LAZY_FLAGS
+	LazyA = A;
+	LazyB = B;
+	LazyCOPending = LAZY_ADD;
+	LazySZ = (A+B) & 0xFFFF;
+	LazySZPending = 1;
+	return LazySZ;
+#else
 	int signa = A & 0x8000;
 	int signb = B & 0x8000;
 	int result = (A+B);
@@ -151,9 +328,16 @@ int AddSetSZOC(int A, int B)
 	Flag_Sign = (result & 0x8000)!=0;
 	Flag_Zero = result==0;
 	return result;
+#endif
 }
 int SubSetOC(int A, int B)
 {
+#ifdef CP1610_LAZY_FLAGS
+	LazyA = A;
+	LazyB = B;
+	LazyCOPending = LAZY_SUB;
+	return (A + (B ^ 0xFFFF) + 1) & 0xFFFF;
+#else
 	int signa = A & 0x8000;
 	int signb = B & 0x8000;
 	int result = (A + (B ^ 0xFFFF) + 1); // A - B using 1's compliment;
@@ -161,20 +345,27 @@ int SubSetOC(int A, int B)
 	Flag_Carry = (result & 0x10000)!=0;
 	Flag_Overflow = (signa!=signb && signa!=signr) ? 1 : 0;
 	return result & 0xFFFF;
+#endif
 }
 
 int CP1610Tick(int debug)
 {
-	// execute one instruction //
-	int sdbd = Flag_DoubleByteData;
-
-	unsigned int instruction = readMem(R[PC]);
+	return Tick();
+}
 
+int TickDefault(void)
+{
+	// execute one instruction //
+	const struct CP1610Decoded *op = &DecodeCache[R[PC] & 0xFFFF];
+	unsigned int instruction;
 	int ticks = 0;
 #if 0
     static int global_ticks = 0;
 #endif
 
+	if(op->generation != DecodeGeneration) { op = CP1610Decode(R[PC]); }
+	instruction = op->instruction;
+
     // DEBUG
 #if 0
     {
@@ -205,17 +396,17 @@ int CP1610Tick(int debug)
 	        // bad OpCode, Halt //
 		return 0;
 	}
+	PROFILE_OPCODE(instruction);
 
 	R[PC]++; // point PC/R7 at operand/next address
     
-	ticks = OpCodes[instruction](instruction); // execute instruction
-
-	if(sdbd==1) { Flag_DoubleByteData = 0; } // reset SDBD
+	Decoded = op;
+	ticks = op->handler(instruction); // execute instruction
 
 	// check interupt request
 	if(Flag_InteruptEnable == 1 && SR1>0)
 	{
-		if(Interuptable[instruction])
+		if(op->interuptable)
 		{
 			// Take VBlank Interupt //
 			SR1 = 0;
@@ -231,6 +422,44 @@ int CP1610Tick(int debug)
 	return ticks;
 }
 
+int TickSDBD(void)
+{
+	// execute the instruction after SDBD from OpCodesSDBD, then go
+	// back to TickDefault
+	const struct CP1610Decoded *op = &DecodeCache[R[PC] & 0xFFFF];
+	unsigned int instruction;
+	int ticks;
+
+	if(op->generation != DecodeGeneration) { op = CP1610Decode(R[PC]); }
+	instruction = op->instruction;
+
+	if(instruction > 0x03FF)
+	{
+		printf("[ERROR][FREEINT] Bad opcode: %i\n", instruction);
+		return 0;
+	}
+	PROFILE_OPCODE(instruction);
+
+	R[PC]++; // point PC/R7 at operand/next address
+
+	Decoded = op;
+	ticks = OpCodesSDBD[instruction](instruction);
+
+	Flag_DoubleByteData = 0; // reset SDBD
+	Tick = TickDefault;
+
+	// check interupt request
+	if(Flag_InteruptEnable == 1 && SR1>0 && op->interuptable)
+	{
+		// Take VBlank Interupt //
+		SR1 = 0;
+		writeIndirect(SP, R[PC]); // push PC...
+		R[PC] = 0x1004; // Jump
+		ticks += 12;
+	}
+	return ticks;
+}
+
 int HLT(int v)
 {
     // Halt Instruction found! //
@@ -240,18 +469,18 @@ int HLT(int v)
     return 0;
 }
 
-int SDBD(int v) { Flag_DoubleByteData = 1; return 4; } // Set Double Byte Data
+int SDBD(int v) { Flag_DoubleByteData = 1; Tick = TickSDBD; return 4; } // Set Double Byte Data
 int EIS(int v)  { Flag_InteruptEnable = 1; return 4; } // Enable Interrupt System
 int DIS(int v)  { Flag_InteruptEnable = 0; return 4; } // Disable Interrupt System
 int Jump(int v)
 { 
 	// J, JE, JD, JSR, JSRE, JSRD, CALL
 	// 0000:0000:0000:0100  0000:00rr:aaaa:aaff  0000:00aa:aaaa:aaaa
-	int decle2 = readOperand();
-	int decle3 = readOperand() & 0x3FF;
+	int decle2 = Decoded->operand;
 	int reg = (decle2>>8) & 0x03; // 0-R4, 1-R5, 2-R6, 3-don't store return address
-	int adr = (((decle2>>2) & 0x3F)<<10) | decle3;
+	int adr = Decoded->target; // decoded from decle2 and decle3
 	int ff = decle2 & 0x03; // Interrupt flag (0-no change, 1-set, 2-clear, 3-undefined)
+	R[PC] += 2; // skip decle2 and decle3
 	if(reg!=3)
 	{
 		reg = reg + 4;
@@ -263,8 +492,8 @@ int Jump(int v)
 	return 13;
 }
 int TCI(int v)  { return 4; } // Terminate Current Interrupt (not used)
-int CLRC(int v) { Flag_Carry = 0; return 4; } // Clear Carry
-int SETC(int v) { Flag_Carry = 1; return 4; } // Set Carry
+int CLRC(int v) { FLAGS_CO(); Flag_Carry = 0; return 4; } // Clear Carry
+int SETC(int v) { FLAGS_CO(); Flag_Carry = 1; return 4; } // Set Carry
 
 #define EXTRA_IF_R6(reg)  (reg == 6 ? 3 : 0)
 #define EXTRA_IF_R6R7(reg)  (reg >= 6 ? 1 : 0)
@@ -300,13 +529,17 @@ int NEGR(int v) // Negate Register (Two's Compliment)
 int ADCR(int v) // Add Carry to Register
 {
 	int reg = v & 0x07;
+	FLAGS_CO();
 	R[reg] = AddSetSZOC(R[reg], Flag_Carry);
     return 6 + EXTRA_IF_R6R7(reg);
 }
 int GSWD(int v) // Get the Status Word szoc:0000:szoc:0000
 {
 	int reg = v & 0x03;
-	unsigned int szoc = (Flag_Sign<<3) | (Flag_Zero<<2) | (Flag_Overflow<<1) | Flag_Carry;
+	unsigned int szoc;
+	FLAGS_SZ();
+	FLAGS_CO();
+	szoc = (Flag_Sign<<3) | (Flag_Zero<<2) | (Flag_Overflow<<1) | Flag_Carry;
 	R[reg] = (szoc<<12) | (szoc<<4);
 	return 6;
 }
@@ -317,6 +550,8 @@ int RSWD(int v) // Return Status Word szoc:0000
 {
 	int reg = v & 0x07;
 	unsigned int szoc = R[reg]>>4;
+	DROP_SZ();
+	DROP_CO();
 	Flag_Sign = (szoc>>3) & 1;
 	Flag_Zero = (szoc>>2) & 1;
 	Flag_Overflow = (szoc>>1) & 1;
@@ -329,6 +564,7 @@ int SWAP(int v) // Swap 0000:0trr
 	int times = (v>>2) & 1;
 	int upper = (R[reg]>>8) & 0xFF;
 	int lower = R[reg] & 0xFF;
+	DROP_SZ();
 	if(times==0) // single swap
 	{
 		R[reg] = (lower<<8) | upper;
@@ -358,6 +594,7 @@ int RLC(int v) // Rotate Left Through Carry
 	int times = ((v>>2) & 1);
 	int bit15 = (R[reg]>>15) & 1;
 	int bit14 = (R[reg]>>14) & 1;
+	FLAGS_CO();
 	if(times==0) // Single rotate
 	{
 		R[reg] = R[reg] << 1;
@@ -385,6 +622,7 @@ int SLLC(int v) // Shift Logical Left through Carry
 	int dist = ((v>>2) & 1)+1;
 	int bit15 = (R[reg]>>15) & 1;
 	int bit14 = (R[reg]>>14) & 1;
+	FLAGS_CO();
 	R[reg] = (R[reg]<<dist);
 	Flag_Carry = bit15;			
 	if(dist==2)
@@ -401,6 +639,7 @@ int SLR(int v) // Shift Logical Right
 	int reg = v & 0x03;
 	int dist = ((v>>2) & 1)+1;
 	R[reg] = R[reg]>>dist;
+	DROP_SZ();
 	Flag_Sign = (R[reg]>>7) & 1;
 	Flag_Zero = R[reg]==0;
 	return 6+(2*(dist-1)); // 6 <<1 or 8 <<2
@@ -421,6 +660,7 @@ int SAR(int v) // Shift Arithmetic Right
 		R[reg] = R[reg] | (bit15<<15);
 		R[reg] = R[reg] | (bit15<<14); // CP-1600 manual says "sign bit copied to high bits"
 	}
+	DROP_SZ();
 	Flag_Sign = (R[reg]>>7) & 1;
 	Flag_Zero = R[reg]==0;
 	return 6+(2*(dist-1)); // 6 <<1 or 8 <<2
@@ -432,6 +672,8 @@ int RRC(int v) // Rotate Right Through Carry
 	int bit1 = (R[reg]>>1) & 1;
 	int bit0 = R[reg] & 1;
 
+	FLAGS_CO();
+	DROP_SZ();
 	if(dist==0)
 	{
 		R[reg] = R[reg]>>1;
@@ -457,6 +699,8 @@ int SARC(int v) // Shift Arithmetic Right Through Carry
 	int bit1 = (R[reg]>>1) & 1;
 	int bit0 = R[reg] & 1;
 
+	FLAGS_CO();
+	DROP_SZ();
 	R[reg] = R[reg]>>dist;
 	R[reg] = R[reg] | (bit15<<15);
 	if(dist==2)
@@ -497,8 +741,7 @@ int CMPR(int v) // Compare Registers
 	int sreg = (v >> 3) & 0x7;
 	int dreg = v & 0x7;
 	int res = SubSetOC(R[dreg], R[sreg]);
-	Flag_Sign = (res & 0x8000)!=0;
-	Flag_Zero = res==0;
+	SetFlagsSZResult(res);
     return 6 + EXTRA_IF_R6R7(dreg);
 }
 int ANDR(int v) // And Registers
@@ -543,6 +786,10 @@ int Branch(int v) // Branch - B, BC, BOV, BPL, BEQ, BLT, BLE, BUSC, NOPP, BNC, B
 		}
 		return 7;
 	}
+#ifdef CP1610_LAZY_FLAGS
+	if(condition==1 || condition==2 || condition>=5) { FLAGS_CO(); }
+	if(condition>=3) { FLAGS_SZ(); }
+#endif
 	switch(condition)
 	{
 		case 0: branch = 1; break; // B, NOPP
@@ -593,16 +840,23 @@ int MVIa(int v) // Move In Indirect 0000:0010:10aa:addd
 	int areg = (v >> 3) & 0x7;
 	int dreg = v & 0x7;	
 	R[dreg] = readIndirect(areg);
-    return (Flag_DoubleByteData == 1 ? 10 : 8) + EXTRA_IF_R6R7(dreg) + EXTRA_IF_R6(areg);
+    return 8 + EXTRA_IF_R6R7(dreg) + EXTRA_IF_R6(areg);
+}
+int MVIaD(int v) // MVI@, MVII after SDBD
+{
+	int areg = (v >> 3) & 0x7;
+	int dreg = v & 0x7;
+	R[dreg] = readIndirectSDBD(areg);
+    return 10 + EXTRA_IF_R6R7(dreg) + EXTRA_IF_R6(areg);
 }
 int MVII(int v) // Move In Immediate (copies operand to register)
 {
-	// These instructions are only one word, so don't advance PC past operand.
-	// Auto incrementing registers will move past the operands automatically.
-	// This works exactly like MVI@ with PC as the address register.
-	// All nnnI instructions work this way.
-	v = v | 0x0038;  // set address register to PC
-	return(MVIa(v)); // call indirect
+	// This works exactly like MVI@ with PC as the address register, but
+	// the operand comes from the decode cache.  All nnnI instructions work
+	// this way; after SDBD they read two bytes through the @ handlers.
+	int dreg = v & 0x7;
+	R[dreg] = readImmediate();
+    return 8 + EXTRA_IF_R6R7(dreg);
 }
 int ADD(int v) // Add
 {
@@ -617,12 +871,22 @@ int ADDa(int v) // Add Indirect
 	int dreg = v & 0x07;
 	int val = readIndirect(areg);
 	R[dreg] = AddSetSZOC(R[dreg], val);
-    return (Flag_DoubleByteData == 1 ? 10 : 8) + EXTRA_IF_R6R7(areg) + EXTRA_IF_R6(areg);
+    return 8 + EXTRA_IF_R6R7(areg) + EXTRA_IF_R6(areg);
+}
+int ADDaD(int v) // ADD@, ADDI after SDBD
+{
+	int areg = (v >> 3) & 0x07;
+	int dreg = v & 0x07;
+	int val = readIndirectSDBD(areg);
+	R[dreg] = AddSetSZOC(R[dreg], val);
+    return 10 + EXTRA_IF_R6R7(areg) + EXTRA_IF_R6(areg);
 }
 int ADDI(int v) // Add Immediate
 {
-	v = v | 0x0038;  // set address register to PC
-	return(ADDa(v)); // call indirect
+	int dreg = v & 0x07;
+	int val = readImmediate();
+	R[dreg] = AddSetSZOC(R[dreg], val);
+    return 8 + EXTRA_IF_R6R7(7);
 }
 int SUB(int v) // Subtract
 {
@@ -639,20 +903,31 @@ int SUBa(int v)  // Subtract Indirect
 	int val = readIndirect(areg);
 	R[dreg] = SubSetOC(R[dreg], val);
 	SetFlagsSZ(dreg);
-    return (Flag_DoubleByteData == 1 ? 10 : 8) + EXTRA_IF_R6R7(areg) + EXTRA_IF_R6(areg);
+    return 8 + EXTRA_IF_R6R7(areg) + EXTRA_IF_R6(areg);
+}
+int SUBaD(int v) // SUB@, SUBI after SDBD
+{
+	int areg = (v >> 3) & 0x07;
+	int dreg = v & 0x07;
+	int val = readIndirectSDBD(areg);
+	R[dreg] = SubSetOC(R[dreg], val);
+	SetFlagsSZ(dreg);
+    return 10 + EXTRA_IF_R6R7(areg) + EXTRA_IF_R6(areg);
 }
 int SUBI(int v) // Subtract Immediate
 {
-	v = v | 0x0038;  // set address register to PC
-	return(SUBa(v)); // call indirect
+	int dreg = v & 0x07;
+	int val = readImmediate();
+	R[dreg] = SubSetOC(R[dreg], val);
+	SetFlagsSZ(dreg);
+    return 8 + EXTRA_IF_R6R7(7);
 }
 int CMP(int v)
 {
 	int reg = v & 0x07;
 	int val = readOperandIndirect();
 	int res = SubSetOC(R[reg], val);
-	Flag_Sign = (res & 0x8000)!=0;
-	Flag_Zero = res==0;
+	SetFlagsSZResult(res);
 	return 10 + EXTRA_IF_R6R7(reg);
 }
 int CMPa(int v)
@@ -661,14 +936,24 @@ int CMPa(int v)
 	int dreg = v & 0x07;
 	int val = readIndirect(areg);
 	int res = SubSetOC(R[dreg], val);
-	Flag_Sign = (res & 0x8000)!=0;
-	Flag_Zero = res==0;
-    return (Flag_DoubleByteData == 1 ? 10 : 8) + EXTRA_IF_R6R7(areg) + EXTRA_IF_R6(areg);
+	SetFlagsSZResult(res);
+    return 8 + EXTRA_IF_R6R7(areg) + EXTRA_IF_R6(areg);
+}
+int CMPaD(int v) // CMP@, CMPI after SDBD
+{
+	int areg = (v >> 3) & 0x07;
+	int dreg = v & 0x07;
+	int val = readIndirectSDBD(areg);
+	int res = SubSetOC(R[dreg], val);
+	SetFlagsSZResult(res);
+    return 10 + EXTRA_IF_R6R7(areg) + EXTRA_IF_R6(areg);
 }
 int CMPI(int v) // CMP Immediate
 {
-	v = v | 0x0038;  // set address register to PC
-	return(CMPa(v)); // call indirect
+	int dreg = v & 0x07;
+	int val = readImmediate();
+	SetFlagsSZResult(SubSetOC(R[dreg], val));
+    return 8 + EXTRA_IF_R6R7(7);
 }
 int AND(int v) // And
 {
@@ -685,12 +970,24 @@ int ANDa(int v) // And Indirect
 	int val = readIndirect(areg);
 	R[dreg] = R[dreg] & val;
 	SetFlagsSZ(dreg);
-    return (Flag_DoubleByteData == 1 ? 10 : 8) + EXTRA_IF_R6R7(areg) + EXTRA_IF_R6(areg);
+    return 8 + EXTRA_IF_R6R7(areg) + EXTRA_IF_R6(areg);
+}
+int ANDaD(int v) // AND@, ANDI after SDBD
+{
+	int areg = (v >> 3) & 0x07;
+	int dreg = v & 0x07;
+	int val = readIndirectSDBD(areg);
+	R[dreg] = R[dreg] & val;
+	SetFlagsSZ(dreg);
+    return 10 + EXTRA_IF_R6R7(areg) + EXTRA_IF_R6(areg);
 }
 int ANDI(int v) // And Immediate
 {
-	v = v | 0x0038;  // set address register to PC
-	return(ANDa(v)); // call indirect
+	int dreg = v & 0x07;
+	int val = readImmediate();
+	R[dreg] = R[dreg] & val;
+	SetFlagsSZ(dreg);
+    return 8 + EXTRA_IF_R6R7(7);
 }
 int XOR(int v) // Xor
 {
@@ -707,83 +1004,871 @@ int XORa(int v) // Xor Indirect
 	int val = readIndirect(areg);
 	R[dreg] = R[dreg] ^ val;
 	SetFlagsSZ(dreg);
-    return (Flag_DoubleByteData == 1 ? 10 : 8) + EXTRA_IF_R6R7(areg) + EXTRA_IF_R6(areg);
+    return 8 + EXTRA_IF_R6R7(areg) + EXTRA_IF_R6(areg);
+}
+int XORaD(int v) // XOR@, XORI after SDBD
+{
+	int areg = (v >> 3) & 0x07;
+	int dreg = v & 0x07;
+	int val = readIndirectSDBD(areg);
+	R[dreg] = R[dreg] ^ val;
+	SetFlagsSZ(dreg);
+    return 10 + EXTRA_IF_R6R7(areg) + EXTRA_IF_R6(areg);
 }
 int XORI(int v) // Xor Immediate
 {
-	v = v | 0x0038;  // set address register to PC
-	return(XORa(v)); // call indirect
+	int dreg = v & 0x07;
+	int val = readImmediate();
+	R[dreg] = R[dreg] ^ val;
+	SetFlagsSZ(dreg);
+    return 8 + EXTRA_IF_R6R7(7);
 }
 
 // Make a big table of function pointers for opcodes
 // as well as a table of flags so that opcodes can
 // be quickly executed and determined to be interuptable 
-void addInstruction(int start, int end, int caninterupt, const char *name, int (*callback)(int))
+void addInstruction(int start, int end, int caninterupt, int operands, const char *name, int (*callback)(int))
 {
 	int i;
 	for(i=start; i<=end; i++)
 	{
 		Interuptable[i] = caninterupt;
+		Operands[i] = operands;
 		Nmemonic[i] = name;
 		OpCodes[i] = callback;
 	}
 }
 
+void addSDBD(int start, int end, int (*callback)(int))
+{
+	int i;
+	for(i=start; i<=end; i++)
+	{
+		OpCodesSDBD[i] = callback;
+	}
+}
+
 void CP1610Init()
 {
-	addInstruction(0x0000, 0x0000, 0, "HLT   ", HLT   );
-	addInstruction(0x0001, 0x0001, 0, "SDBD  ", SDBD  );
-	addInstruction(0x0002, 0x0002, 0, "EIS   ", EIS   );
-	addInstruction(0x0003, 0x0003, 0, "DIS   ", DIS   );
-	addInstruction(0x0004, 0x0004, 1, "Jump  ", Jump  ); // J, JE, JD, JSR, JSRE, JSRD, CALL
-	addInstruction(0x0005, 0x0005, 0, "TCI   ", TCI   );
-	addInstruction(0x0006, 0x0006, 0, "CLRC  ", CLRC  );
-	addInstruction(0x0007, 0x0007, 0, "SETC  ", SETC  );
-	addInstruction(0x0008, 0x000F, 1, "INCR  ", INCR  );
-	addInstruction(0x0010, 0x0017, 1, "DECR  ", DECR  );
-	addInstruction(0x0018, 0x001F, 1, "COMR  ", COMR  );
-	addInstruction(0x0020, 0x0027, 1, "NEGR  ", NEGR  );
-	addInstruction(0x0028, 0x002F, 1, "ADCR  ", ADCR  );
-	addInstruction(0x0030, 0x0033, 1, "GSWD  ", GSWD  );
-	addInstruction(0x0034, 0x0035, 1, "NOP   ", NOP   );
-	addInstruction(0x0036, 0x0037, 1, "SIN   ", SIN   );
-	addInstruction(0x0038, 0x003F, 1, "RSWD  ", RSWD  );
-	addInstruction(0x0040, 0x0047, 0, "SWAP  ", SWAP  );
-	addInstruction(0x0048, 0x004F, 0, "SLL   ", SLL   );
-	addInstruction(0x0050, 0x0057, 0, "RLC   ", RLC   );
-	addInstruction(0x0058, 0x005F, 0, "SLLC  ", SLLC  );
-	addInstruction(0x0060, 0x0067, 0, "SLR   ", SLR   );
-	addInstruction(0x0068, 0x006F, 0, "SAR   ", SAR   );
-	addInstruction(0x0070, 0x0077, 0, "RRC   ", RRC   );
-	addInstruction(0x0078, 0x007F, 0, "SARC  ", SARC  );
-	addInstruction(0x0080, 0x00BF, 1, "MOVR  ", MOVR  );
-	addInstruction(0x00C0, 0x00FF, 1, "ADDR  ", ADDR  );
-	addInstruction(0x0100, 0x013F, 1, "SUBR  ", SUBR  );
-	addInstruction(0x0140, 0x017F, 1, "CMPR  ", CMPR  );
-	addInstruction(0x0180, 0x01BF, 1, "ANDR  ", ANDR  );
-	addInstruction(0x01C0, 0x01FF, 1, "XORR  ", XORR  );
-	addInstruction(0x0200, 0x023F, 1, "Branch", Branch); // B, BC, BOV, BPL, BEQ, BLT, BLE, BUSC, NOPP, BNC, BNOV, BMI, BNEQ, BGE, BGT, BESC, BEXT
-	addInstruction(0x0240, 0x0247, 0, "MVO   ", MVO   );
-	addInstruction(0x0248, 0x026F, 0, "MVO@  ", MVOa  ); // error in wiki for all aaa@ and aaaI instructions
-	addInstruction(0x0270, 0x0277, 0, "PSHR  ", MVOa  ); //
-	addInstruction(0x0278, 0x027F, 0, "MVOI  ", MVOI  ); //
-	addInstruction(0x0280, 0x0287, 1, "MVI   ", MVI   );
-	addInstruction(0x0288, 0x02AF, 1, "MVI@  ", MVIa  ); 
-	addInstruction(0x02B0, 0x02B7, 1, "PULR  ", MVIa  );
-	addInstruction(0x02B8, 0x02BF, 1, "MVII  ", MVII  ); 
-	addInstruction(0x02C0, 0x02C7, 1, "ADD   ", ADD   ); 
-	addInstruction(0x02C8, 0x02F7, 1, "ADD@  ", ADDa  );
-	addInstruction(0x02F8, 0x02FF, 1, "ADDI  ", ADDI  ); 
-	addInstruction(0x0300, 0x0307, 1, "SUB   ", SUB   );
-	addInstruction(0x0308, 0x0337, 1, "SUB@  ", SUBa  );
-	addInstruction(0x0338, 0x033F, 1, "SUBI  ", SUBI  );
-	addInstruction(0x0340, 0x0347, 1, "CMP   ", CMP   );
-	addInstruction(0x0348, 0x0377, 1, "CMP@  ", CMPa  );
-	addInstruction(0x0378, 0x037F, 1, "CMPI  ", CMPI  );
-	addInstruction(0x0380, 0x0387, 1, "AND   ", AND   );
-	addInstruction(0x0388, 0x03B7, 1, "AND@  ", ANDa  );
-	addInstruction(0x03B8, 0x03BF, 1, "ANDI  ", ANDI  );
-	addInstruction(0x03C0, 0x03C7, 1, "XOR   ", XOR   );
-	addInstruction(0x03C8, 0x03F7, 1, "XOR@  ", XORa  );
-	addInstruction(0x03F8, 0x03FF, 1, "XORI  ", XORI  );
+	addInstruction(0x0000, 0x0000, 0, 0, "HLT   ", HLT   );
+	addInstruction(0x0001, 0x0001, 0, 0, "SDBD  ", SDBD  );
+	addInstruction(0x0002, 0x0002, 0, 0, "EIS   ", EIS   );
+	addInstruction(0x0003, 0x0003, 0, 0, "DIS   ", DIS   );
+	addInstruction(0x0004, 0x0004, 1, 2, "Jump  ", Jump  ); // J, JE, JD, JSR, JSRE, JSRD, CALL
+	addInstruction(0x0005, 0x0005, 0, 0, "TCI   ", TCI   );
+	addInstruction(0x0006, 0x0006, 0, 0, "CLRC  ", CLRC  );
+	addInstruction(0x0007, 0x0007, 0, 0, "SETC  ", SETC  );
+	addInstruction(0x0008, 0x000F, 1, 0, "INCR  ", INCR  );
+	addInstruction(0x0010, 0x0017, 1, 0, "DECR  ", DECR  );
+	addInstruction(0x0018, 0x001F, 1, 0, "COMR  ", COMR  );
+	addInstruction(0x0020, 0x0027, 1, 0, "NEGR  ", NEGR  );
+	addInstruction(0x0028, 0x002F, 1, 0, "ADCR  ", ADCR  );
+	addInstruction(0x0030, 0x0033, 1, 0, "GSWD  ", GSWD  );
+	addInstruction(0x0034, 0x0035, 1, 0, "NOP   ", NOP   );
+	addInstruction(0x0036, 0x0037, 1, 0, "SIN   ", SIN   );
+	addInstruction(0x0038, 0x003F, 1, 0, "RSWD  ", RSWD  );
+	addInstruction(0x0040, 0x0047, 0, 0, "SWAP  ", SWAP  );
+	addInstruction(0x0048, 0x004F, 0, 0, "SLL   ", SLL   );
+	addInstruction(0x0050, 0x0057, 0, 0, "RLC   ", RLC   );
+	addInstruction(0x0058, 0x005F, 0, 0, "SLLC  ", SLLC  );
+	addInstruction(0x0060, 0x0067, 0, 0, "SLR   ", SLR   );
+	addInstruction(0x0068, 0x006F, 0, 0, "SAR   ", SAR   );
+	addInstruction(0x0070, 0x0077, 0, 0, "RRC   ", RRC   );
+	addInstruction(0x0078, 0x007F, 0, 0, "SARC  ", SARC  );
+	addInstruction(0x0080, 0x00BF, 1, 0, "MOVR  ", MOVR  );
+	addInstruction(0x00C0, 0x00FF, 1, 0, "ADDR  ", ADDR  );
+	addInstruction(0x0100, 0x013F, 1, 0, "SUBR  ", SUBR  );
+	addInstruction(0x0140, 0x017F, 1, 0, "CMPR  ", CMPR  );
+	addInstruction(0x0180, 0x01BF, 1, 0, "ANDR  ", ANDR  );
+	addInstruction(0x01C0, 0x01FF, 1, 0, "XORR  ", XORR  );
+	addInstruction(0x0200, 0x023F, 1, 1, "Branch", Branch); // B, BC, BOV, BPL, BEQ, BLT, BLE, BUSC, NOPP, BNC, BNOV, BMI, BNEQ, BGE, BGT, BESC, BEXT
+	addInstruction(0x0240, 0x0247, 0, 1, "MVO   ", MVO   );
+	addInstruction(0x0248, 0x026F, 0, 0, "MVO@  ", MVOa  ); // error in wiki for all aaa@ and aaaI instructions
+	addInstruction(0x0270, 0x0277, 0, 0, "PSHR  ", MVOa  ); //
+	addInstruction(0x0278, 0x027F, 0, 0, "MVOI  ", MVOI  ); //
+	addInstruction(0x0280, 0x0287, 1, 1, "MVI   ", MVI   );
+	addInstruction(0x0288, 0x02AF, 1, 0, "MVI@  ", MVIa  ); 
+	addInstruction(0x02B0, 0x02B7, 1, 0, "PULR  ", MVIa  );
+	addInstruction(0x02B8, 0x02BF, 1, 1, "MVII  ", MVII  ); 
+	addInstruction(0x02C0, 0x02C7, 1, 1, "ADD   ", ADD   ); 
+	addInstruction(0x02C8, 0x02F7, 1, 0, "ADD@  ", ADDa  );
+	addInstruction(0x02F8, 0x02FF, 1, 1, "ADDI  ", ADDI  ); 
+	addInstruction(0x0300, 0x0307, 1, 1, "SUB   ", SUB   );
+	addInstruction(0x0308, 0x0337, 1, 0, "SUB@  ", SUBa  );
+	addInstruction(0x0338, 0x033F, 1, 1, "SUBI  ", SUBI  );
+	addInstruction(0x0340, 0x0347, 1, 1, "CMP   ", CMP   );
+	addInstruction(0x0348, 0x0377, 1, 0, "CMP@  ", CMPa  );
+	addInstruction(0x0378, 0x037F, 1, 1, "CMPI  ", CMPI  );
+	addInstruction(0x0380, 0x0387, 1, 1, "AND   ", AND   );
+	addInstruction(0x0388, 0x03B7, 1, 0, "AND@  ", ANDa  );
+	addInstruction(0x03B8, 0x03BF, 1, 1, "ANDI  ", ANDI  );
+	addInstruction(0x03C0, 0x03C7, 1, 1, "XOR   ", XOR   );
+	addInstruction(0x03C8, 0x03F7, 1, 0, "XOR@  ", XORa  );
+	addInstruction(0x03F8, 0x03FF, 1, 1, "XORI  ", XORI  );
+
+	// After SDBD only the indirect and immediate reads change (double
+	// byte data), everything else runs its usual handler
+	memcpy(OpCodesSDBD, OpCodes, sizeof(OpCodes));
+	addSDBD(0x0288, 0x02BF, MVIaD); // MVI@, PULR, MVII
+	addSDBD(0x02C8, 0x02FF, ADDaD); // ADD@, ADDI
+	addSDBD(0x0308, 0x033F, SUBaD); // SUB@, SUBI
+	addSDBD(0x0348, 0x037F, CMPaD); // CMP@, CMPI
+	addSDBD(0x0388, 0x03BF, ANDaD); // AND@, ANDI
+	addSDBD(0x03C8, 0x03FF, XORaD); // XOR@, XORI
+#ifdef CP1610_THREADED
+	CP1610ThreadedInit();
+#endif
+}
+
+/*
+	Idle loop detection
+
+	A jump or branch backwards arms the watch with the registers and flags
+	at its target.  If execution comes back to the target with the same
+	registers and flags, having made no memory writes and no reads that can
+	change on their own, every further pass around the loop does exactly
+	the same thing.  CP1610Run then skips the passes that fit in its budget
+	and only adds their cycles; the PSG and Intellivoice catch up to
+	CP1610Clock as usual.  Taking the interrupt pushes to the stack, so a
+	pass that is interrupted never matches.  Everything else a loop can
+	read (STIC, GRAM, controllers) only changes between CP1610Run calls.
+*/
+
+#define IDLE_MAX_INSTRUCTIONS 64 // longest loop body watched
+
+struct {
+	int armed;
+	unsigned int pc;    // loop start
+	unsigned int r[7];  // R0-R6 at loop start
+	int flags;
+	int cycles;         // cycles for one pass
+	int instructions;
+	unsigned int writes;
+	unsigned int volatiles;
+} Idle;
+
+void IdleArm(const unsigned int *r, int flags)
+{
+	memcpy(&Idle.r[0], r, sizeof(Idle.r));
+	Idle.pc = r[PC];
+	Idle.flags = flags;
+	Idle.cycles = 0;
+	Idle.instructions = 0;
+	Idle.writes = MemoryWrites;
+	Idle.volatiles = MemoryVolatileReads;
+	Idle.armed = 1;
+}
+
+// Whether IdleCheck will look at the flags after this instruction: at the
+// loop start, or to arm the watch.  Lazy flags are only worked out then,
+// not on every instruction of the loop.
+int IdleWantsFlags(unsigned int pc, int backward)
+{
+	if(Idle.armed)
+	{
+		return pc==Idle.pc || (backward && Idle.instructions+1 >= IDLE_MAX_INSTRUCTIONS);
+	}
+	return backward;
+}
+
+// Called after an instruction that jumped backwards, and after every
+// instruction while armed.  flags only has to be right when
+// IdleWantsFlags says so.  Returns the cycles of one pass around a loop
+// proven idle, 0 otherwise.
+int IdleCheck(const unsigned int *r, int flags, int ticks, int backward)
+{
+	if(Idle.armed)
+	{
+		Idle.cycles += ticks;
+		Idle.instructions++;
+		if(r[PC]==Idle.pc)
+		{
+			if(Idle.writes==MemoryWrites && Idle.volatiles==MemoryVolatileReads &&
+				flags==Idle.flags && memcmp(&Idle.r[0], r, sizeof(Idle.r))==0)
+			{
+				Idle.armed = 0;
+				return Idle.cycles;
+			}
+			IdleArm(r, flags); // something changed, watch the next pass
+			return 0;
+		}
+		if(Idle.instructions < IDLE_MAX_INSTRUCTIONS) { return 0; }
+		Idle.armed = 0;
+	}
+	if(backward) { IdleArm(r, flags); }
+	return 0;
+}
+
+// Cycles of whole idle passes that fit in what is left of the budget,
+// stopping short of it so the last pass still runs for real
+int IdleSkip(int pass, int left)
+{
+	if(left <= pass) { return 0; }
+	return ((left - 1) / pass) * pass;
+}
+
+#ifdef CP1610_THREADED
+/*
+	Threaded-code interpreter
+
+	Same instruction semantics as the handlers above, but the registers and
+	flags are kept in locals for the length of a CP1610Run call and every
+	opcode is a label inside one dispatch loop.  GCC and clang dispatch with
+	computed goto; other compilers (MSVC) fall back to a switch.
+	Build with CP1610_THREADED=1 to use it in place of the OpCodes table.
+*/
+
+#if defined(__GNUC__) || defined(__clang__)
+#define CP1610_COMPUTED_GOTO
+#endif
+
+enum {
+	OP_HLT, OP_SDBD, OP_EIS, OP_DIS, OP_Jump, OP_TCI, OP_CLRC, OP_SETC,
+	OP_INCR, OP_DECR, OP_COMR, OP_NEGR, OP_ADCR, OP_GSWD, OP_NOP, OP_RSWD,
+	OP_SWAP, OP_SLL, OP_RLC, OP_SLLC, OP_SLR, OP_SAR, OP_RRC, OP_SARC,
+	OP_MOVR, OP_ADDR, OP_SUBR, OP_CMPR, OP_ANDR, OP_XORR, OP_Branch,
+	OP_MVO, OP_MVOa, OP_MVI, OP_MVIa, OP_ADD, OP_ADDa, OP_SUB, OP_SUBa,
+	OP_CMP, OP_CMPa, OP_AND, OP_ANDa, OP_XOR, OP_XORa,
+	OP_SDBDNext, OP_SDBDAgain, OP_MVIaD, OP_ADDaD, OP_SUBaD, OP_CMPaD,
+	OP_ANDaD, OP_XORaD, OP_MVII, OP_ADDI, OP_SUBI, OP_CMPI, OP_ANDI, OP_XORI
+};
+
+unsigned char OpClass[0x400]; // dispatch label for each opcode
+unsigned char OpClassSDBD[0x400]; // dispatch label for the opcode after SDBD
+
+// The immediate forms already have the address register field set to R7.
+// MVOI shares the indirect label, the reads take their operand from the
+// decode cache and then join the indirect code.
+struct {
+	int (*handler)(int);
+	unsigned char op;
+} HandlerClass[] = {
+	{ HLT,  OP_HLT  }, { SDBD, OP_SDBD }, { EIS,  OP_EIS  }, { DIS,  OP_DIS  },
+	{ Jump, OP_Jump }, { TCI,  OP_TCI  }, { CLRC, OP_CLRC }, { SETC, OP_SETC },
+	{ INCR, OP_INCR }, { DECR, OP_DECR }, { COMR, OP_COMR }, { NEGR, OP_NEGR },
+	{ ADCR, OP_ADCR }, { GSWD, OP_GSWD }, { NOP,  OP_NOP  }, { SIN,  OP_NOP  },
+	{ RSWD, OP_RSWD }, { SWAP, OP_SWAP }, { SLL,  OP_SLL  }, { RLC,  OP_RLC  },
+	{ SLLC, OP_SLLC }, { SLR,  OP_SLR  }, { SAR,  OP_SAR  }, { RRC,  OP_RRC  },
+	{ SARC, OP_SARC }, { MOVR, OP_MOVR }, { ADDR, OP_ADDR }, { SUBR, OP_SUBR },
+	{ CMPR, OP_CMPR }, { ANDR, OP_ANDR }, { XORR, OP_XORR }, { Branch, OP_Branch },
+	{ MVO,  OP_MVO  }, { MVOa, OP_MVOa }, { MVOI, OP_MVOa }, { MVI,  OP_MVI  },
+	{ MVIa, OP_MVIa }, { MVII, OP_MVII }, { ADD,  OP_ADD  }, { ADDa, OP_ADDa },
+	{ ADDI, OP_ADDI }, { SUB,  OP_SUB  }, { SUBa, OP_SUBa }, { SUBI, OP_SUBI },
+	{ CMP,  OP_CMP  }, { CMPa, OP_CMPa }, { CMPI, OP_CMPI }, { AND,  OP_AND  },
+	{ ANDa, OP_ANDa }, { ANDI, OP_ANDI }, { XOR,  OP_XOR  }, { XORa, OP_XORa },
+	{ XORI, OP_XORI },
+};
+
+void CP1610ThreadedInit(void)
+{
+	int i, j;
+	for(i=0; i<0x400; i++)
+	{
+		for(j=0; j<sizeof(HandlerClass)/sizeof(HandlerClass[0]); j++)
+		{
+			if(OpCodes[i]==HandlerClass[j].handler) { OpClass[i] = HandlerClass[j].op; }
+		}
+
+		// After SDBD the indirect and immediate reads have their own
+		// labels, anything else drops the SDBD state and runs as usual
+		switch(OpClass[i])
+		{
+			case OP_SDBD: OpClassSDBD[i] = OP_SDBDAgain; break;
+			case OP_MVIa: case OP_MVII: OpClassSDBD[i] = OP_MVIaD; break;
+			case OP_ADDa: case OP_ADDI: OpClassSDBD[i] = OP_ADDaD; break;
+			case OP_SUBa: case OP_SUBI: OpClassSDBD[i] = OP_SUBaD; break;
+			case OP_CMPa: case OP_CMPI: OpClassSDBD[i] = OP_CMPaD; break;
+			case OP_ANDa: case OP_ANDI: OpClassSDBD[i] = OP_ANDaD; break;
+			case OP_XORa: case OP_XORI: OpClassSDBD[i] = OP_XORaD; break;
+			default: OpClassSDBD[i] = OP_SDBDNext; break;
+		}
+	}
+}
+
+// Local versions of SetFlagsSZ, AddSetSZOC, SubSetOC, readIndirect and writeIndirect
+#define T_SETSZ(reg) { r[reg] &= 0xFFFF; s = (r[reg] & 0x8000)!=0; z = r[reg]==0; }
+#define T_ADD(dst, A, B) { \
+	unsigned int ta = (A), tb = (B), tr = ta + tb; \
+	o = ((ta & 0x8000)==(tb & 0x8000) && (ta & 0x8000)!=(tr & 0x8000)); \
+	c = (tr & 0x10000)!=0; \
+	tr &= 0xFFFF; \
+	s = (tr & 0x8000)!=0; \
+	z = tr==0; \
+	dst = tr; }
+#define T_SUB(dst, A, B) { \
+	unsigned int ta = (A), tb = (B), tr = ta + (tb ^ 0xFFFF) + 1; \
+	c = (tr & 0x10000)!=0; \
+	o = ((ta & 0x8000)!=(tb & 0x8000) && (ta & 0x8000)!=(tr & 0x8000)); \
+	dst = tr & 0xFFFF; }
+#define T_READ_INDIRECT(reg) { \
+	if(reg==6) { r[reg] = r[reg] - 1; } \
+	adr = r[reg]; \
+	val = readMem(adr); \
+	if(reg==4 || reg==5 || reg==7) { r[reg] = (r[reg]+1) & 0xFFFF; } }
+// readIndirectSDBD, also ends the SDBD state
+#define T_READ_INDIRECT_SDBD(reg) { \
+	T_READ_INDIRECT(reg); \
+	val &= 0xff; \
+	if(reg==4 || reg==5 || reg==7) { \
+		val |= ((readMem(adr+1) & 0xFF)<<8); \
+		r[reg] = (r[reg]+1) & 0xFFFF; \
+	} else { \
+		val |= val << 8; \
+	} \
+	d = 0; \
+	classes = OpClass; }
+// readImmediate, an nnnI operand from the decode cache
+#define T_READ_IMMEDIATE() { \
+	r[7] = (r[7]+1) & 0xFFFF; \
+	val = op->operand; }
+#define T_WRITE_INDIRECT(reg, v) { \
+	val = (v); \
+	adr = r[reg]; \
+	writeMem(adr, val); \
+	if(reg>=4) { r[reg] = (r[reg]+1) & 0xFFFF; } }
+#define T_INDIRECT_TICKS EXTRA_IF_R6R7(areg) + EXTRA_IF_R6(areg) // on top of 8, or 10 after SDBD
+
+#ifdef CP1610_COMPUTED_GOTO
+#define T_OP(name) op_##name:
+#else
+#define T_OP(name) case OP_##name:
+#endif
+#define T_NEXT goto retire
+
+int CP1610Run(int budget)
+{
+#ifdef CP1610_COMPUTED_GOTO
+	static const void *dispatch[] = {
+		&&op_HLT, &&op_SDBD, &&op_EIS, &&op_DIS, &&op_Jump, &&op_TCI, &&op_CLRC, &&op_SETC,
+		&&op_INCR, &&op_DECR, &&op_COMR, &&op_NEGR, &&op_ADCR, &&op_GSWD, &&op_NOP, &&op_RSWD,
+		&&op_SWAP, &&op_SLL, &&op_RLC, &&op_SLLC, &&op_SLR, &&op_SAR, &&op_RRC, &&op_SARC,
+		&&op_MOVR, &&op_ADDR, &&op_SUBR, &&op_CMPR, &&op_ANDR, &&op_XORR, &&op_Branch,
+		&&op_MVO, &&op_MVOa, &&op_MVI, &&op_MVIa, &&op_ADD, &&op_ADDa, &&op_SUB, &&op_SUBa,
+		&&op_CMP, &&op_CMPa, &&op_AND, &&op_ANDa, &&op_XOR, &&op_XORa,
+		&&op_SDBDNext, &&op_SDBDAgain, &&op_MVIaD, &&op_ADDaD, &&op_SUBaD, &&op_CMPaD,
+		&&op_ANDaD, &&op_XORaD, &&op_MVII, &&op_ADDI, &&op_SUBI, &&op_CMPI, &&op_ANDI, &&op_XORI
+	};
+#endif
+	unsigned int r[8];
+	int s = Flag_Sign;
+	int z = Flag_Zero;
+	int o = Flag_Overflow;
+	int c = Flag_Carry;
+	int d = Flag_DoubleByteData;
+	int ie = Flag_InteruptEnable;
+	const unsigned char *classes = d ? OpClassSDBD : OpClass; // OpClassSDBD right after SDBD
+	const struct CP1610Decoded *op;
+	unsigned int instruction;
+	int reg, areg, dreg, adr, val, res, dist, bit;
+	int ticks, pc, pass, skip, backward;
+	int used = 0;
+	int count = 0;
+
+	CP1610Halted = 0;
+	Idle.armed = 0;
+	memcpy(&r[0], &R[0], sizeof(r));
+
+	while(used < budget)
+	{
+		op = &DecodeCache[r[7] & 0xFFFF];
+		if(op->generation != DecodeGeneration) { op = CP1610Decode(r[7]); }
+		instruction = op->instruction;
+		if(instruction > 0x03FF)
+		{
+			printf("[ERROR][FREEINT] Bad opcode: %i\n", instruction);
+			CP1610Halted = 1; // bad OpCode, Halt
+			break;
+		}
+		PROFILE_OPCODE(instruction);
+
+		pc = r[7];
+		r[7]++; // point PC/R7 at operand/next address
+		reg = instruction & 0x07;
+		areg = (instruction >> 3) & 0x07;
+		dreg = reg;
+
+	redispatch:
+#ifdef CP1610_COMPUTED_GOTO
+		goto *dispatch[classes[instruction]];
+#else
+		switch(classes[instruction])
+#endif
+		{
+		T_OP(HLT)
+			printf("\n\n[ERROR] [FREEINTV] HALT!\n");
+			r[7]--;
+			ticks = 0;
+			T_NEXT;
+		T_OP(SDBD) d = 1; classes = OpClassSDBD; ticks = 4; T_NEXT;
+		T_OP(SDBDAgain) d = 0; classes = OpClass; ticks = 4; T_NEXT; // SDBD, SDBD
+		T_OP(SDBDNext) // not affected by SDBD
+			d = 0;
+			classes = OpClass;
+			goto redispatch;
+		T_OP(EIS)  ie = 1; ticks = 4; T_NEXT;
+		T_OP(DIS)  ie = 0; ticks = 4; T_NEXT;
+		T_OP(TCI)  ticks = 4; T_NEXT;
+		T_OP(CLRC) c = 0; ticks = 4; T_NEXT;
+		T_OP(SETC) c = 1; ticks = 4; T_NEXT;
+		T_OP(NOP)  ticks = 6; T_NEXT;
+		T_OP(Jump)
+			reg = (op->operand>>8) & 0x03;
+			r[7] += 2;
+			if(reg!=3) { r[reg+4] = r[7]; }
+			if((op->operand & 0x03)==1) { ie = 1; }
+			if((op->operand & 0x03)==2) { ie = 0; }
+			r[7] = op->target;
+			ticks = 13;
+			T_NEXT;
+		T_OP(INCR)
+			r[reg] = r[reg]+1;
+			T_SETSZ(reg);
+			ticks = 6 + EXTRA_IF_R6R7(reg);
+			T_NEXT;
+		T_OP(DECR)
+			r[reg] = r[reg]-1;
+			T_SETSZ(reg);
+			ticks = 6 + EXTRA_IF_R6R7(reg);
+			T_NEXT;
+		T_OP(COMR)
+			r[reg] = r[reg] ^ 0xFFFF;
+			T_SETSZ(reg);
+			ticks = 6 + EXTRA_IF_R6R7(reg);
+			T_NEXT;
+		T_OP(NEGR)
+			T_SUB(r[reg], 0, r[reg]);
+			T_SETSZ(reg);
+			ticks = 6 + EXTRA_IF_R6R7(reg);
+			T_NEXT;
+		T_OP(ADCR)
+			T_ADD(r[reg], r[reg], c);
+			ticks = 6 + EXTRA_IF_R6R7(reg);
+			T_NEXT;
+		T_OP(GSWD)
+			val = (s<<3) | (z<<2) | (o<<1) | c;
+			r[reg & 0x03] = (val<<12) | (val<<4);
+			ticks = 6;
+			T_NEXT;
+		T_OP(RSWD)
+			val = r[reg]>>4;
+			s = (val>>3) & 1;
+			z = (val>>2) & 1;
+			o = (val>>1) & 1;
+			c = val & 1;
+			ticks = 6;
+			T_NEXT;
+		T_OP(SWAP)
+			reg &= 0x03;
+			if(((instruction>>2) & 1)==0)
+			{
+				r[reg] = ((r[reg] & 0xFF)<<8) | ((r[reg]>>8) & 0xFF);
+				ticks = 6;
+			}
+			else
+			{
+				r[reg] = ((r[reg] & 0xFF)<<8) | (r[reg] & 0xFF);
+				ticks = 8;
+			}
+			s = (r[reg]>>7) & 1;
+			z = r[reg]==0;
+			T_NEXT;
+		T_OP(SLL)
+			reg &= 0x03;
+			dist = ((instruction>>2) & 1)+1;
+			r[reg] = r[reg]<<dist;
+			T_SETSZ(reg);
+			ticks = 6+(2*(dist-1));
+			T_NEXT;
+		T_OP(RLC)
+			reg &= 0x03;
+			dist = (instruction>>2) & 1;
+			bit = (r[reg]>>14) & 3;
+			if(dist==0)
+			{
+				r[reg] = (r[reg] << 1) | c;
+			}
+			else
+			{
+				r[reg] = (r[reg] << 2) | ((c << 1) | o);
+				o = bit & 1;
+			}
+			c = bit>>1;
+			T_SETSZ(reg);
+			ticks = 6+(2*dist);
+			T_NEXT;
+		T_OP(SLLC)
+			reg &= 0x03;
+			dist = ((instruction>>2) & 1)+1;
+			bit = (r[reg]>>14) & 3;
+			r[reg] = r[reg]<<dist;
+			c = bit>>1;
+			if(dist==2) { o = bit & 1; }
+			T_SETSZ(reg);
+			ticks = 6+(2*(dist-1));
+			T_NEXT;
+		T_OP(SLR)
+			reg &= 0x03;
+			dist = ((instruction>>2) & 1)+1;
+			r[reg] = r[reg]>>dist;
+			s = (r[reg]>>7) & 1;
+			z = r[reg]==0;
+			ticks = 6+(2*(dist-1));
+			T_NEXT;
+		T_OP(SAR)
+			reg &= 0x03;
+			dist = ((instruction>>2) & 1)+1;
+			bit = (r[reg]>>15) & 1;
+			r[reg] = (r[reg]>>dist) | (bit<<15);
+			if(dist==2) { r[reg] |= bit<<14; }
+			s = (r[reg]>>7) & 1;
+			z = r[reg]==0;
+			ticks = 6+(2*(dist-1));
+			T_NEXT;
+		T_OP(RRC)
+			reg &= 0x03;
+			dist = (instruction>>2) & 1;
+			bit = r[reg] & 3;
+			if(dist==0)
+			{
+				r[reg] = (r[reg]>>1) | (c<<15);
+			}
+			else
+			{
+				r[reg] = (r[reg]>>2) | (o<<15) | (c<<14);
+				o = bit>>1;
+			}
+			c = bit & 1;
+			s = (r[reg]>>7) & 1;
+			z = r[reg]==0;
+			ticks = 6+(2*dist);
+			T_NEXT;
+		T_OP(SARC)
+			reg &= 0x03;
+			dist = ((instruction>>2) & 1)+1;
+			bit = r[reg] & 3;
+			val = (r[reg]>>15) & 1;
+			r[reg] = (r[reg]>>dist) | (val<<15);
+			if(dist==2)
+			{
+				r[reg] |= val<<14;
+				o = bit>>1;
+			}
+			c = bit & 1;
+			s = (r[reg]>>7) & 1;
+			z = r[reg]==0;
+			ticks = 6+(2*(dist-1));
+			T_NEXT;
+		T_OP(MOVR)
+			r[dreg] = r[areg];
+			T_SETSZ(dreg);
+			ticks = 6 + EXTRA_IF_R6R7(dreg);
+			T_NEXT;
+		T_OP(ADDR)
+			T_ADD(r[dreg], r[dreg], r[areg]);
+			ticks = 6 + EXTRA_IF_R6R7(dreg);
+			T_NEXT;
+		T_OP(SUBR)
+			T_SUB(r[dreg], r[dreg], r[areg]);
+			T_SETSZ(dreg);
+			ticks = 6 + EXTRA_IF_R6R7(dreg);
+			T_NEXT;
+		T_OP(CMPR)
+			T_SUB(res, r[dreg], r[areg]);
+			s = (res & 0x8000)!=0;
+			z = res==0;
+			ticks = 6 + EXTRA_IF_R6R7(dreg);
+			T_NEXT;
+		T_OP(ANDR)
+			r[dreg] = r[dreg] & r[areg];
+			T_SETSZ(dreg);
+			ticks = 6 + EXTRA_IF_R6R7(dreg);
+			T_NEXT;
+		T_OP(XORR)
+			r[dreg] = r[dreg] ^ r[areg];
+			T_SETSZ(dreg);
+			ticks = 6 + EXTRA_IF_R6R7(dreg);
+			T_NEXT;
+		T_OP(Branch)
+			r[7]++;
+			if(((instruction >> 4) & 0x01)==1) // BEXT
+			{
+				res = (InstructionRegister & 0x0F)==(instruction & 0x0F);
+			}
+			else
+			{
+				switch(instruction & 0x07)
+				{
+					case 0: res = 1; break; // B, NOPP
+					case 1: res = (c==1); break; // BC, BNC
+					case 2: res = (o==1); break; // BOV, BNOV
+					case 3: res = (s==0); break; // BPL, BMI
+					case 4: res = (z==1); break; // BEQ, BNEQ
+					case 5: res = (s!=o); break; // BLT, BGE
+					case 6: res = (z==1)||(s!=o); break; // BLE, BGT
+					default: res = (s!=c); break; // BUSC, BESC
+				}
+				if(((instruction >> 3) & 0x01)==1) { res = !res; }
+			}
+			ticks = 7;
+			if(res)
+			{
+				if(((instruction >> 5) & 0x01)==0) { r[7] = r[7]+op->operand; }
+				else { r[7] = r[7]-(op->operand+1); }
+				ticks = 9;
+			}
+			T_NEXT;
+		T_OP(MVO)
+			r[7]++;
+			writeMem(op->operand, r[reg]);
+			ticks = 11;
+			T_NEXT;
+		T_OP(MVOa) // MVO@, PSHR, MVOI
+			T_WRITE_INDIRECT(areg, r[reg]);
+			ticks = 9;
+			T_NEXT;
+		T_OP(MVI)
+			val = readMem(op->operand);
+			r[7]++;
+			r[reg] = val;
+			ticks = 10 + EXTRA_IF_R6R7(reg);
+			T_NEXT;
+		T_OP(MVIaD)
+			T_READ_INDIRECT_SDBD(areg);
+			ticks = 10;
+			goto mvia;
+		T_OP(MVII)
+			T_READ_IMMEDIATE();
+			ticks = 8;
+			goto mvia;
+		T_OP(MVIa) // MVI@, PULR
+			T_READ_INDIRECT(areg);
+			ticks = 8;
+		mvia:
+			r[dreg] = val;
+			ticks += EXTRA_IF_R6R7(dreg) + EXTRA_IF_R6(areg);
+			T_NEXT;
+		T_OP(ADD)
+			val = readMem(op->operand);
+			r[7]++;
+			T_ADD(r[reg], r[reg], val);
+			ticks = 10 + EXTRA_IF_R6R7(reg);
+			T_NEXT;
+		T_OP(ADDaD)
+			T_READ_INDIRECT_SDBD(areg);
+			ticks = 10;
+			goto adda;
+		T_OP(ADDI)
+			T_READ_IMMEDIATE();
+			ticks = 8;
+			goto adda;
+		T_OP(ADDa) // ADD@
+			T_READ_INDIRECT(areg);
+			ticks = 8;
+		adda:
+			T_ADD(r[dreg], r[dreg], val);
+			ticks += T_INDIRECT_TICKS;
+			T_NEXT;
+		T_OP(SUB)
+			val = readMem(op->operand);
+			r[7]++;
+			T_SUB(r[reg], r[reg], val);
+			T_SETSZ(reg);
+			ticks = 10 + EXTRA_IF_R6R7(reg);
+			T_NEXT;
+		T_OP(SUBaD)
+			T_READ_INDIRECT_SDBD(areg);
+			ticks = 10;
+			goto suba;
+		T_OP(SUBI)
+			T_READ_IMMEDIATE();
+			ticks = 8;
+			goto suba;
+		T_OP(SUBa) // SUB@
+			T_READ_INDIRECT(areg);
+			ticks = 8;
+		suba:
+			T_SUB(r[dreg], r[dreg], val);
+			T_SETSZ(dreg);
+			ticks += T_INDIRECT_TICKS;
+			T_NEXT;
+		T_OP(CMP)
+			val = readMem(op->operand);
+			r[7]++;
+			T_SUB(res, r[reg], val);
+			s = (res & 0x8000)!=0;
+			z = res==0;
+			ticks = 10 + EXTRA_IF_R6R7(reg);
+			T_NEXT;
+		T_OP(CMPaD)
+			T_READ_INDIRECT_SDBD(areg);
+			ticks = 10;
+			goto cmpa;
+		T_OP(CMPI)
+			T_READ_IMMEDIATE();
+			ticks = 8;
+			goto cmpa;
+		T_OP(CMPa) // CMP@
+			T_READ_INDIRECT(areg);
+			ticks = 8;
+		cmpa:
+			T_SUB(res, r[dreg], val);
+			s = (res & 0x8000)!=0;
+			z = res==0;
+			ticks += T_INDIRECT_TICKS;
+			T_NEXT;
+		T_OP(AND)
+			val = readMem(op->operand);
+			r[7]++;
+			r[reg] = r[reg] & val;
+			T_SETSZ(reg);
+			ticks = 10 + EXTRA_IF_R6R7(reg);
+			T_NEXT;
+		T_OP(ANDaD)
+			T_READ_INDIRECT_SDBD(areg);
+			ticks = 10;
+			goto anda;
+		T_OP(ANDI)
+			T_READ_IMMEDIATE();
+			ticks = 8;
+			goto anda;
+		T_OP(ANDa) // AND@
+			T_READ_INDIRECT(areg);
+			ticks = 8;
+		anda:
+			r[dreg] = r[dreg] & val;
+			T_SETSZ(dreg);
+			ticks += T_INDIRECT_TICKS;
+			T_NEXT;
+		T_OP(XOR)
+			val = readMem(op->operand);
+			r[7]++;
+			r[reg] = r[reg] ^ val;
+			T_SETSZ(reg);
+			ticks = 10 + EXTRA_IF_R6R7(reg);
+			T_NEXT;
+		T_OP(XORaD)
+			T_READ_INDIRECT_SDBD(areg);
+			ticks = 10;
+			goto xora;
+		T_OP(XORI)
+			T_READ_IMMEDIATE();
+			ticks = 8;
+			goto xora;
+		T_OP(XORa) // XOR@
+			T_READ_INDIRECT(areg);
+			ticks = 8;
+		xora:
+			r[dreg] = r[dreg] ^ val;
+			T_SETSZ(dreg);
+			ticks += T_INDIRECT_TICKS;
+			T_NEXT;
+		}
+
+	retire:
+		if(ticks==0) { CP1610Halted = 1; break; } // HLT
+		used += ticks;
+		CP1610Clock += ticks;
+		count++;
+
+		// check interupt request
+		if(ie == 1 && SR1>0 && op->interuptable)
+		{
+			// Take VBlank Interupt //
+			SR1 = 0;
+			T_WRITE_INDIRECT(6, r[7]); // push PC...
+			r[7] = 0x1004; // Jump
+			used += 12;
+			CP1610Clock += 12;
+			break;
+		}
+
+		if(SR1>0)
+		{
+			SR1 = SR1 - ticks;
+			if(SR1<0) { SR1 = 0; }
+		}
+
+		if(Idle.armed || r[7] <= pc)
+		{
+			backward = r[7] <= pc;
+			pass = IdleCheck(r, IdleWantsFlags(r[7], backward) ? s | z<<1 | o<<2 | c<<3 | d<<4 | ie<<5 : 0, ticks, backward);
+			if(pass)
+			{
+				skip = IdleSkip(pass, budget - used);
+				used += skip;
+				CP1610Clock += skip;
+				count += (skip / pass) * Idle.instructions;
+				SR1 = SR1 > skip ? SR1 - skip : 0;
+			}
+		}
+	}
+
+	memcpy(&R[0], &r[0], sizeof(r));
+	Flag_Sign = s;
+	Flag_Zero = z;
+	Flag_Overflow = o;
+	Flag_Carry = c;
+	Flag_DoubleByteData = d;
+	Flag_InteruptEnable = ie;
+	Tick = d ? TickSDBD : TickDefault;
+	CP1610Instructions += count;
+	return used;
+}
+
+#else
+
+int IdleFlags(void)
+{
+	FLAGS_SZ();
+	FLAGS_CO();
+	return Flag_Sign | Flag_Zero<<1 | Flag_Overflow<<2 | Flag_Carry<<3 |
+		Flag_DoubleByteData<<4 | Flag_InteruptEnable<<5;
 }
+
+int CP1610Run(int budget)
+{
+	int ticks;
+	int irq;
+	unsigned int pc;
+	int pass, skip, backward;
+	int used = 0;
+	int count = 0;
+
+	CP1610Halted = 0;
+	Idle.armed = 0;
+	while(used < budget)
+	{
+		irq = SR1>0;
+		pc = R[PC];
+		ticks = Tick();
+		if(ticks==0) { CP1610Halted = 1; break; } // HLT or bad opcode
+		used += ticks;
+		CP1610Clock += ticks;
+		count++;
+
+		if(SR1>0)
+		{
+			SR1 = SR1 - ticks;
+			if(SR1<0) { SR1 = 0; }
+		}
+		else if(irq) { break; } // CP1610Tick took the interrupt
+
+		if(Idle.armed || R[PC] <= pc)
+		{
+			backward = R[PC] <= pc;
+			pass = IdleCheck(R, IdleWantsFlags(R[PC], backward) ? IdleFlags() : 0, ticks, backward);
+			if(pass)
+			{
+				skip = IdleSkip(pass, budget - used);
+				used += skip;
+				CP1610Clock += skip;
+				count += (skip / pass) * Idle.instructions;
+				SR1 = SR1 > skip ? SR1 - skip : 0;
+			}
+		}
+	}
+	CP1610Instructions += count;
+	return used;
+}
+
+#endif
@@ -37,4 +37,19 @@ void CP1610Reset(void); // reset cpu
 
 int CP1610Tick(int debug); // execute a single instruction, return cycles used
 
+// execute instructions until at least budget cycles are used, the VBlank
+// interrupt is taken or the cpu halts (CP1610Halted), return cycles used.
+// Counts down SR1 as it goes.
+int CP1610Run(int budget);
+
+extern int CP1610Halted;
+
+extern unsigned int CP1610Clock; // cycle counter the PSG and Intellivoice catch up to
+
+extern unsigned int CP1610Instructions; // instruction counter (benchmarks)
+
+void CP1610Invalidate(int adr); // drop predecoded instructions overlapping adr (called from writeMem)
+
+void CP1610FlushCache(void); // drop all predecoded instructions (after bulk Memory changes)
+
 #endif
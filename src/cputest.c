@@ -0,0 +1,202 @@
+/*
+	This file is part of FreeIntv.
+
+	FreeIntv is free software; you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation; either version 2 of the License, or
+	(at your option) any later version.
+
+	FreeIntv is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License along
+	with FreeIntv; if not, write to the Free Software Foundation, Inc.,
+	51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+// CPU core equivalence test (make cputest)
+//
+// Runs random CP1610 programs and prints what the cpu did:
+//   freeintvds_cputest [-n programs] [-s seed] [-v]
+//
+// make cputest links it once per cpu core (table, threaded, each with
+// eager and lazy flags) and checks that all of them print the same thing.
+// Each program fills all of memory with random opcodes and operands plus
+// a few loops for the idle loop detection, then runs in CP1610Run batches
+// of random length with the VBlank interrupt raised now and then.  After
+// every batch the registers, flags (CP1610Serialize works out lazy ones),
+// SR1, CP1610Clock and CP1610Instructions go into a digest; at the end of
+// the program the memory and MemoryWrites do too.  A halt (HLT or a bad
+// opcode) restarts the cpu at a random address.
+//
+// One line per program; -v adds one per batch, to find where two cores
+// part ways.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "intv.h"
+#include "memory.h"
+#include "cp1610.h"
+
+#define CPUTEST_BATCHES 200 // CP1610Run calls per program
+
+unsigned int Random;
+
+unsigned int nextRandom(void) // xorshift32
+{
+	Random ^= Random << 13;
+	Random ^= Random >> 17;
+	Random ^= Random << 5;
+	return Random;
+}
+
+unsigned int Digest;
+
+void digest(unsigned int val) // FNV-1a over 32 bit words
+{
+	int i;
+	for(i=0; i<4; i++)
+	{
+		Digest ^= (val >> (i*8)) & 0xFF;
+		Digest *= 16777619u;
+	}
+}
+
+void randomProgram(void)
+{
+	int i, adr;
+	unsigned int word;
+
+	for(i=0; i<0x10000; i++)
+	{
+		word = nextRandom();
+		// mostly opcodes, so a jump into operands keeps running
+		Memory[i] = (word & 0x3F0000) ? (word >> 22) & 0x3FF : word >> 16;
+	}
+	// HLT is opcode 0, make it rarer than one in 1024
+	for(i=0; i<0x10000; i++)
+	{
+		if(Memory[i]==0 && (nextRandom() & 3)) { Memory[i] = 0x0034; } // NOP
+	}
+	for(i=0; i<64; i++)
+	{
+		adr = nextRandom() & 0xFFFC;
+		switch(nextRandom() & 3)
+		{
+			case 0: // B $, idle
+				Memory[adr] = 0x0220;
+				Memory[adr+1] = 0x0001;
+				break;
+			case 1: // DECR Rn, BNEQ back to it
+				Memory[adr] = 0x0010 | (nextRandom() & 3);
+				Memory[adr+1] = 0x022C;
+				Memory[adr+2] = 0x0002;
+				break;
+			case 2: // MVI Rn / BEQ $-2, polls memory
+				Memory[adr] = 0x0280 | (nextRandom() & 3);
+				Memory[adr+1] = nextRandom() & 0xFFFF;
+				Memory[adr+2] = 0x0224;
+				Memory[adr+3] = 0x0004;
+				break;
+			default: // SDBD MVII, double byte immediate
+				Memory[adr] = 0x0001;
+				Memory[adr+1] = 0x02B8 | (nextRandom() & 7);
+				break;
+		}
+	}
+	CP1610FlushCache(); // Memory was written directly
+}
+
+void randomRegisters(struct CP1610serialized *cpu)
+{
+	int i;
+	memset(cpu, 0, sizeof(*cpu));
+	for(i=0; i<8; i++)
+	{
+		cpu->R[i] = nextRandom() & 0xFFFF;
+	}
+	cpu->Flag_Carry = nextRandom() & 1;
+	cpu->Flag_Sign = nextRandom() & 1;
+	cpu->Flag_Zero = nextRandom() & 1;
+	cpu->Flag_Overflow = nextRandom() & 1;
+	cpu->Flag_InteruptEnable = nextRandom() & 1;
+}
+
+void usage(void)
+{
+	printf("usage: freeintvds_cputest [-n programs] [-s seed] [-v]\n");
+}
+
+int main(int argc, char *argv[])
+{
+	struct CP1610serialized cpu;
+	int programs = 500;
+	unsigned int seed = 1;
+	int verbose = 0;
+	unsigned int clock, instructions, writes;
+	int i, p, b, used;
+
+	for(i=1; i<argc; i++)
+	{
+		if(strcmp(argv[i], "-n")==0 && i+1<argc) { programs = atoi(argv[++i]); }
+		else if(strcmp(argv[i], "-s")==0 && i+1<argc) { seed = strtoul(argv[++i], NULL, 0); }
+		else if(strcmp(argv[i], "-v")==0) { verbose = 1; }
+		else { usage(); return 1; }
+	}
+
+	Init();
+	for(p=0; p<programs; p++)
+	{
+		Random = (seed * 2654435761u) ^ (p + 1) * 40503u;
+		if(Random==0) { Random = 1; }
+		Reset();
+		randomProgram();
+		randomRegisters(&cpu);
+		CP1610Unserialize(&cpu);
+		// counted from here, the PSG and Intellivoice catch up to CP1610Clock
+		clock = CP1610Clock;
+		instructions = CP1610Instructions;
+		writes = MemoryWrites;
+		Digest = 2166136261u;
+
+		for(b=0; b<CPUTEST_BATCHES; b++)
+		{
+			if((nextRandom() & 7)==0) { SR1 = 1 + nextRandom() % 3000; } // VBlank
+			used = CP1610Run(1 + nextRandom() % 2000);
+
+			CP1610Serialize(&cpu);
+			digest(used);
+			digest(CP1610Halted);
+			digest(SR1);
+			digest(CP1610Clock - clock);
+			digest(CP1610Instructions - instructions);
+			for(i=0; i<8; i++) { digest(cpu.R[i]); }
+			digest(cpu.Flag_Sign | cpu.Flag_Zero<<1 | cpu.Flag_Overflow<<2 | cpu.Flag_Carry<<3 |
+				cpu.Flag_DoubleByteData<<4 | cpu.Flag_InteruptEnable<<5);
+			if(verbose)
+			{
+				printf("  %4d %5d %04x %04x %04x %04x %04x %04x %04x %04x %c%c%c%c%c%c %s\n", b, used,
+					cpu.R[0], cpu.R[1], cpu.R[2], cpu.R[3], cpu.R[4], cpu.R[5], cpu.R[6], cpu.R[7],
+					cpu.Flag_Sign ? 'S' : '-', cpu.Flag_Zero ? 'Z' : '-', cpu.Flag_Overflow ? 'O' : '-',
+					cpu.Flag_Carry ? 'C' : '-', cpu.Flag_InteruptEnable ? 'I' : '-',
+					cpu.Flag_DoubleByteData ? 'D' : '-', CP1610Halted ? "halt" : "");
+			}
+
+			if(CP1610Halted) // carry on somewhere else
+			{
+				cpu.R[7] = nextRandom() & 0xFFFF;
+				cpu.Flag_DoubleByteData = 0;
+				CP1610Unserialize(&cpu);
+			}
+		}
+
+		for(i=0; i<0x10000; i++) { digest(Memory[i]); }
+		digest(MemoryWrites - writes);
+		printf("program %4d  digest %08x  cycles %10u  instructions %9u  writes %8u\n",
+			p, Digest, CP1610Clock - clock, CP1610Instructions - instructions, MemoryWrites - writes);
+	}
+	return 0;
+}
@@ -26,6 +26,7 @@
 #include "cart.h"
 #include "osd.h"
 #include "ivoice.h"
+#include "profile.h"
 
 int SR1;
 int intv_halt;
@@ -34,7 +35,10 @@ int exec(void);
 
 void LoadGame(const char* path) // load cart rom //
 {
-	if(LoadCart(path))
+	int loaded = LoadCart(path);
+	CP1610FlushCache(); // cart loaders write Memory directly
+	STICFlushCache();
+	if(loaded)
 	{
 		OSD_drawText(3, 3, "LOAD CART: OKAY");
 	}
@@ -59,6 +63,7 @@ void loadExec(const char* path)
 		}
 
 		fclose(fp);
+		CP1610FlushCache();
 		OSD_drawText(3, 1, "LOAD EXEC: OKAY");
 		printf("[INFO] [FREEINTV] Succeeded loading Executive BIOS from: %s\n", path);		
 	}
@@ -85,6 +90,8 @@ void loadGrom(const char* path)
 		}
 
 		fclose(fp);
+		CP1610FlushCache();
+		STICFlushCache();
 		OSD_drawText(3, 2, "LOAD GROM: OKAY");
 		printf("[INFO] [FREEINTV] Succeeded loading Graphics BIOS from: %s\n", path);
 		
@@ -121,13 +128,22 @@ void Run()
 	while(exec()) { }
 }
 
-int exec(void) // Run one instruction 
+int exec(void) // Run the cpu up to the next STIC phase boundary
 {
     int ticks;
-    
-    ticks = CP1610Tick(0); // Tick CP-1610 CPU, runs one instruction, returns used cycles
+    int budget = phase_len + 1; // phase ends once phase_len goes negative
+    int dv, dh; // vertical and horizontal delay, the STIC's delayV/delayH belong to the render code
 
-	if(ticks==0)    // Undefined instruction (>= 0x0400) or HLT
+    if(budget < 1) { budget = 1; }
+    PROFILE_BEGIN(PROFILE_CPU);
+    ticks = CP1610Run(budget); // Tick CP-1610 CPU, runs instructions until the budget is used, returns used cycles
+    PROFILE_END(PROFILE_CPU);
+
+    // The PSG and Intellivoice catch up to CP1610Clock on their own when
+    // their registers are accessed, and at the end of the frame below
+    phase_len -= ticks;
+
+	if(CP1610Halted)    // Undefined instruction (>= 0x0400) or HLT
 	{
         // DEBUG
 #if 0
@@ -139,23 +155,12 @@ int exec(void) // Run one instruction
             fprintf(stdout, "%04x:[%03x] %04x %04x %04x %04x %04x %04x %04x\n", R[7], readMem(R[7]), R[0], R[1], R[2], R[3], R[4], R[5], R[6]);
         }
 #endif
+        PSGSync();
+        ivoice_sync();
         intv_halt = 1;
 		return 0;
 	}
 
-	// Tick PSG
-	PSGTick(ticks);
- 
-    // Tick Intellivoice
-    ivoice_tk(ticks);
-    
-    if(SR1>0)
-    {
-        SR1 = SR1 - ticks;
-        if(SR1<0) { SR1 = 0; }
-    }
-    
-    phase_len -= ticks;
     if (phase_len < 0) {
         stic_phase = (stic_phase + 1) & 15;
         switch (stic_phase) {
@@ -164,8 +169,12 @@ int exec(void) // Run one instruction
                 stic_gram = 1;  // GRAM accessible
                 phase_len += 2900;
                 SR1 = phase_len;
+                PSGSync();
+                ivoice_sync();
                 // Render Frame //
+                PROFILE_BEGIN(PROFILE_STIC);
                 STICDrawFrame(stic_vid_enable);
+                PROFILE_END(PROFILE_STIC);
                 // The following line was below just after
                 //   "stic_vid_enable = DisplayEnabled;"
                 // It caused D1K Homebrew to fail:
@@ -182,45 +191,47 @@ int exec(void) // Run one instruction
                 stic_gram = 1;  // GRAM accessible
                 break;
             case 2:
-                delayV = ((Memory[0x31])&0x7);
-                delayH = ((Memory[0x30])&0x7);
-                phase_len += 120 + 114 * delayV + delayH;
+                dv = ((Memory[0x31])&0x7);
+                dh = ((Memory[0x30])&0x7);
+                phase_len += 120 + 114 * dv + dh;
                 if (stic_vid_enable) {
                     stic_gram = 0;  // GRAM now inaccessible
                     phase_len -= 68;    // BUSRQ period (STIC reads RAM)
-                    PSGTick(68);
-                    ivoice_tk(68);
+                    CP1610Clock += 68; // cpu stalled, PSG and Intellivoice keep running
                 }
                 break;
             default:
                 phase_len += 912;
                 if (stic_vid_enable) {
                     phase_len -= 108;   // BUSRQ period (STIC reads RAM)
-                    PSGTick(108);
-                    ivoice_tk(108);
+                    CP1610Clock += 108; // cpu is stalled, time still passes
                 }
                 break;
             case 14:
-                delayV = ((Memory[0x31])&0x7);
-                delayH = ((Memory[0x30])&0x7);
-                phase_len += 912 - 114 * delayV - delayH;
+                dv = ((Memory[0x31])&0x7);
+                dh = ((Memory[0x30])&0x7);
+                phase_len += 912 - 114 * dv - dh;
                 if (stic_vid_enable) {
                     phase_len -= 108;   // BUSRQ period (STIC reads RAM)
-                    PSGTick(108);
-                    ivoice_tk(108);
+                    CP1610Clock += 108; // cpu is stalled, time still passes
                 }
                 break;
             case 15:
-                delayV = ((Memory[0x31])&0x7);
+                dv = ((Memory[0x31])&0x7);
                 phase_len += 57 + 17;
-                if (stic_vid_enable && delayV == 0) {
+                if (stic_vid_enable && dv == 0) {
                     phase_len -= 38;    // BUSRQ period (STIC reads RAM)
-                    PSGTick(38);
-                    ivoice_tk(38);
+                    CP1610Clock += 38; // cpu is stalled, time still passes
                 }
                 break;
                 
         }
+        if (STICIncremental && stic_phase >= 2 && stic_phase <= 14) {
+            // card rows drawn as the STIC fetches them
+            PROFILE_BEGIN(PROFILE_STIC);
+            STICDrawPhase(stic_phase, stic_vid_enable);
+            PROFILE_END(PROFILE_STIC);
+        }
     }
     return 1;
 }
@@ -66,6 +66,8 @@
 #include "retro_inline.h"
 #include "intv.h"
 #include "ivoice.h"
+#include "cp1610.h"
+#include "profile.h"
 
 #define CONDFREE(p)  if (p) free(p)
 
@@ -1315,72 +1317,69 @@ static void sp0256_micro(ivoice_t *iv)
 }
 
 /* ======================================================================== */
-/*  IVOICE_TK    -- Where the magic happens.  Generate voice data for       */
-/*                  our good friend, the Intellivoice.                      */
+/*  IVOICE_DRAIN -- Move samples from the scratch buffer into the output    */
+/*                  buffer, resampling to the output rate.                  */
 /* ======================================================================== */
-uint32_t ivoice_tk(uint32_t len)
+static void ivoice_drain(ivoice_t *ivoice, int sys_clock, int clock_per_samp)
 {
-    ivoice_t *ivoice = &intellivoice;
-    uint64_t until = (ivoice->now + len) * 4;
-    int samples, did_samp, old_idx;
-    int sys_clock = ivoice->pal_mode ? 4000000 : 3579545;
-    int clock_per_samp = ivoice->pal_mode ? 400 : 358;
-
     /* -------------------------------------------------------------------- */
-    /*  If the rest of the machine hasn't caught up to us, just return.     */
+    /*  Renormalize our sc_head and sc_tail.                                */
     /* -------------------------------------------------------------------- */
-    if (until <= ivoice->sound_current) {
-        ivoice->now += len;
-        return 0;
+    while (ivoice->sc_head > SCBUF_SIZE && ivoice->sc_tail > SCBUF_SIZE)
+    {
+        ivoice->sc_head -= SCBUF_SIZE;
+        ivoice->sc_tail -= SCBUF_SIZE;
     }
 
     /* -------------------------------------------------------------------- */
-    /*  Iterate the sound engine.                                           */
+    /*  First, drain as much of our scratch buffer as we can into the       */
+    /*  sound buffers.                                                      */
     /* -------------------------------------------------------------------- */
-    while (ivoice->sound_current < until)
+    while (ivoice->sc_tail < ivoice->sc_head)
     {
-        /* ---------------------------------------------------------------- */
-        /*  Renormalize our sc_head and sc_tail.                            */
-        /* ---------------------------------------------------------------- */
-        while (ivoice->sc_head > SCBUF_SIZE && ivoice->sc_tail > SCBUF_SIZE)
+        int32_t s, ws;
+
+        ws = s = ivoice->scratch[ivoice->sc_tail++ & SCBUF_MASK];
+
+        if (ivoice->skipping < 0.0)
         {
-            ivoice->sc_head -= SCBUF_SIZE;
-            ivoice->sc_tail -= SCBUF_SIZE;
+            ivoice->skipping += 1.0;
+            continue;
         }
 
-        /* ---------------------------------------------------------------- */
-        /*  First, drain as much of our scratch buffer as we can into the   */
-        /*  sound buffers.                                                  */
-        /* ---------------------------------------------------------------- */
-        while (ivoice->sc_tail < ivoice->sc_head)
+        if (ivoice->time_scale <= 1.0)
         {
-            int32_t s, ws;
+            ivoice->sample_frc += ivoice->rate * clock_per_samp /
+                                    ivoice->time_scale;
+        } else
+        {
+            ivoice->sample_frc += ivoice->rate * clock_per_samp;
+            ivoice->skipping += ivoice->time_scale - 1.0;
+        }
 
-            ws = s = ivoice->scratch[ivoice->sc_tail++ & SCBUF_MASK];
+        if (ivoice->skipping >= 512.0)
+            ivoice->skipping = -ivoice->skipping;
 
-            if (ivoice->skipping < 0.0)
-            {
-                ivoice->skipping += 1.0;
-                continue;
-            }
+        /* ------------------------------------------------------------ */
+        /*  Update the sliding window in down-sample mode               */
+        /* ------------------------------------------------------------ */
+        if (ivoice->rate < 10000)
+        {
+            ivoice->wind_sum -= ivoice->window[ivoice->wind_ptr  ];
+            ivoice->wind_sum += ivoice->window[ivoice->wind_ptr++] = s;
+            if (ivoice->wind_ptr >= ivoice->wind) ivoice->wind_ptr = 0;
 
-            if (ivoice->time_scale <= 1.0)
-            {
-                ivoice->sample_frc += ivoice->rate * clock_per_samp /
-                                        ivoice->time_scale;
-            } else
-            {
-                ivoice->sample_frc += ivoice->rate * clock_per_samp;
-                ivoice->skipping += ivoice->time_scale - 1.0;
-            }
+            ws = ivoice->wind_sum / ivoice->wind;
+        }
 
-            if (ivoice->skipping >= 512.0)
-                ivoice->skipping = -ivoice->skipping;
+        while (ivoice->sample_frc > sys_clock)
+        {
+            ivoice->sample_frc -= sys_clock;
 
-            /* ------------------------------------------------------------ */
-            /*  Update the sliding window in down-sample mode               */
-            /* ------------------------------------------------------------ */
-            if (ivoice->rate < 10000)
+            /* ---------------------------------------------------- */
+            /*  Update the sliding window in up-sample mode         */
+            /* ---------------------------------------------------- */
+            if (ivoice->rate >= 10000)
             {
                 ivoice->wind_sum -= ivoice->window[ivoice->wind_ptr  ];
                 ivoice->wind_sum += ivoice->window[ivoice->wind_ptr++] = s;
@@ -1389,36 +1388,48 @@ uint32_t ivoice_tk(uint32_t len)
                 ws = ivoice->wind_sum / ivoice->wind;
             }
 
-            while (ivoice->sample_frc > sys_clock)
-            {
-                ivoice->sample_frc -= sys_clock;
+            /* ---------------------------------------------------- */
+            /*  Store out the current sample.                       */
+            /* ---------------------------------------------------- */
+            ivoice->cur_buf[ivoice->cur_len++] = ws;
 
-                /* -------------------------------------------------------- */
-                /*  Update the sliding window in up-sample mode             */
-                /* -------------------------------------------------------- */
-                if (ivoice->rate >= 10000)
-                {
-                    ivoice->wind_sum -= ivoice->window[ivoice->wind_ptr  ];
-                    ivoice->wind_sum += ivoice->window[ivoice->wind_ptr++] = s;
-                    if (ivoice->wind_ptr >= ivoice->wind) ivoice->wind_ptr = 0;
+            /* ---------------------------------------------------- */
+            /*  Commit the buffer when it's full.                   */
+            /* ---------------------------------------------------- */
+            if (ivoice->cur_len >= ivoiceBufferSize)
+            {
+                ivoice->cur_len = 0;
+            }
+        }
+    }
+}
 
-                    ws = ivoice->wind_sum / ivoice->wind;
-                }
+/* ======================================================================== */
+/*  IVOICE_TK    -- Where the magic happens.  Generate voice data for       */
+/*                  our good friend, the Intellivoice.                      */
+/* ======================================================================== */
+uint32_t ivoice_tk(uint32_t len)
+{
+    ivoice_t *ivoice = &intellivoice;
+    uint64_t until = (ivoice->now + len) * 4;
+    int samples, did_samp, old_idx;
+    int sys_clock = ivoice->pal_mode ? 4000000 : 3579545;
+    int clock_per_samp = ivoice->pal_mode ? 400 : 358;
 
-                /* -------------------------------------------------------- */
-                /*  Store out the current sample.                           */
-                /* -------------------------------------------------------- */
-                ivoice->cur_buf[ivoice->cur_len++] = ws;
+    /* -------------------------------------------------------------------- */
+    /*  If the rest of the machine hasn't caught up to us, just return.     */
+    /* -------------------------------------------------------------------- */
+    if (until <= ivoice->sound_current) {
+        ivoice->now += len;
+        return 0;
+    }
 
-                /* -------------------------------------------------------- */
-                /*  Commit the buffer when it's full.                       */
-                /* -------------------------------------------------------- */
-                if (ivoice->cur_len >= ivoiceBufferSize)
-                {
-                    ivoice->cur_len = 0;
-                }
-            }
-        }
+    /* -------------------------------------------------------------------- */
+    /*  Iterate the sound engine.                                           */
+    /* -------------------------------------------------------------------- */
+    while (ivoice->sound_current < until)
+    {
+        ivoice_drain(ivoice, sys_clock, clock_per_samp);
 
         /* ---------------------------------------------------------------- */
         /*  Calculate the number of samples required at ~10kHz.             */
@@ -1473,6 +1484,12 @@ uint32_t ivoice_tk(uint32_t len)
         ivoice->sound_current += did_samp * clock_per_samp;
     }
 
+    /* -------------------------------------------------------------------- */
+    /*  Drain what we just generated, so that a long run doesn't leave its  */
+    /*  last chunk sitting in the scratch buffer until the next call.       */
+    /* -------------------------------------------------------------------- */
+    ivoice_drain(ivoice, sys_clock, clock_per_samp);
+
 //  if (per->now*4 - ivoice->sound_current > THRESH)
 //      ivoice->snd_buf.drop++;
     ivoice->now += len;
@@ -1481,6 +1498,25 @@ uint32_t ivoice_tk(uint32_t len)
 }
 
 
+/* ======================================================================== */
+/*  IVOICE_SYNC  -- Run the Intellivoice up to CP1610Clock.  Called before  */
+/*                  its registers are accessed and at the end of a frame.   */
+/* ======================================================================== */
+static uint32_t ivoice_clock = 0;
+
+void ivoice_sync(void)
+{
+    uint32_t len = CP1610Clock - ivoice_clock;
+
+    if (len > 0)
+    {
+        PROFILE_BEGIN(PROFILE_IVOICE);
+        ivoice_tk(len);
+        PROFILE_END(PROFILE_IVOICE);
+        ivoice_clock = CP1610Clock;
+    }
+}
+
 /* ======================================================================== */
 /*  IVOICE_RD    -- Handle reads from the Intellivoice.                     */
 /* ======================================================================== */
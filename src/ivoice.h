@@ -75,6 +75,7 @@ void ivoiceSerialize(struct ivoiceSerialized *);
 void ivoiceUnserialize(const struct ivoiceSerialized *);
 
 uint32_t ivoice_tk(uint32_t);
+void ivoice_sync(void);
 uint32_t ivoice_rd(uint32_t);
 void ivoice_wr(uint32_t, uint32_t);
 void ivoice_reset(void);
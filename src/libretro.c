@@ -23,6 +23,9 @@
 #include <string.h>
 #include <stdio.h>
 #include <stdint.h>
+#ifdef FREEINTV_THREADS
+#include <pthread.h>
+#endif
 
 bool libretro_supports_option_categories = false;
 #include "stb_image.h"
@@ -39,6 +42,7 @@ bool libretro_supports_option_categories = false;
 #include "psg.h"
 #include "ivoice.h"
 #include "stic.h"
+#include "profile.h"
 #ifndef AUDIO_FREQUENCY
 #define AUDIO_FREQUENCY 44100
 #endif
@@ -144,8 +148,9 @@ static void debug_render_hotspots(unsigned int *buffer, int buf_width, int buf_h
 #define OVERLAY_HEIGHT 901   // 620 * 1.454 = 901.48
 
 // DUAL-SCREEN IMPLEMENTATION
-static int dual_screen_enabled = 1;  // RE-ENABLED with scaled vertical layout for Android
+static int dual_screen_enabled = 1;  // "Dual Screen" option, see set_dual_screen
 static void* dual_screen_buffer = NULL;
+static void* dual_screen_back = NULL;  // composited by the render thread, swapped in by renderSync
 static const int GAME_WIDTH = 352;
 static const int GAME_HEIGHT = 224;
 
@@ -163,6 +168,55 @@ static int controller_base_loaded = 0;
 static int controller_base_width = 446;   // Controller base actual width
 static int controller_base_height = 620;  // Controller base actual height (full overlay region)
 
+// Controller region of the workspace composited from the layers above,
+// as much of OVERLAY_HEIGHT as fits under the game screen
+#define OVERLAY_LAYER_HEIGHT (OVERLAY_HEIGHT < WORKSPACE_HEIGHT - GAME_SCREEN_HEIGHT ? OVERLAY_HEIGHT : WORKSPACE_HEIGHT - GAME_SCREEN_HEIGHT)
+static unsigned int* overlay_layer = NULL;
+static unsigned int overlay_layer_generation = 0;  // bumped by each build_overlay_layer
+
+// Dual-screen layouts ("Dual Screen Layout" option).  Hotspots, utility
+// buttons and the artwork are placed for the full WORKSPACE_WIDTH x
+// WORKSPACE_HEIGHT workspace; the smaller layouts show the game at 2x or
+// 1x with the controller region scaled down by num/den below it.
+typedef struct {
+    const char* name;   // core option value
+    int width;          // workspace size
+    int height;
+    int game_scale;     // 2: 704x448, 1: 352x224
+    int game_height;    // rows above the controller region
+    int layer_height;   // rows of the controller region (overlay_layer)
+    int num;            // controller region scale
+    int den;
+} dual_layout_t;
+
+#define DUAL_LAYOUT(name, game_scale, game_height, num, den) \
+    { name, WORKSPACE_WIDTH * (num) / (den), (game_height) + OVERLAY_LAYER_HEIGHT * (num) / (den), \
+      game_scale, game_height, OVERLAY_LAYER_HEIGHT * (num) / (den), num, den }
+
+static const dual_layout_t dual_layouts[] = {
+    DUAL_LAYOUT("full",    2, GAME_SCREEN_HEIGHT, 1, 1),   // 1024x1486
+    DUAL_LAYOUT("medium",  2, 448, 11, 16),                // 704x1021
+    DUAL_LAYOUT("compact", 1, 224, 11, 32),                // 352x510
+};
+static const dual_layout_t* layout = &dual_layouts[0];
+
+// Dual-screen buffers carry two state words after the pixels: the
+// overlay_layer generation their controller region holds and the hotspot
+// highlighted in it.  Frontend memory starts from a fresh state each frame.
+#define DUAL_SCREEN_STATE (layout->width * layout->height)
+#define DUAL_SCREEN_LAYER 0
+#define DUAL_SCREEN_HIGHLIGHT 1
+
+static void* dual_screen_alloc(void)
+{
+    unsigned int* buffer = (unsigned int*)malloc((DUAL_SCREEN_STATE + 2) * sizeof(unsigned int));
+    if (buffer) {
+        buffer[DUAL_SCREEN_STATE + DUAL_SCREEN_LAYER] = 0;  // no layer copied yet
+        buffer[DUAL_SCREEN_STATE + DUAL_SCREEN_HIGHLIGHT] = (unsigned int)-1;
+    }
+    return buffer;
+}
+
 // Initialize overlay hotspots (call after controller base dimensions are known)
 // Hotspots are positioned in workspace coordinates (704px wide)
 static void init_overlay_hotspots(void)
@@ -413,63 +467,55 @@ static void load_overlay_for_rom(const char* rom_path)
     }
     
     overlay_loaded = 1;
-    strncpy(current_rom_path, rom_path, sizeof(current_rom_path) - 1);
 }
 
-// Detect which hotspot (if any) is currently pressed based on controller state
-// Returns hotspot index (0-11) or -1 if none pressed
-static int detect_pressed_hotspot(int controller_value)
+// Area-average src down to dst, for the smaller layouts
+static void scale_down(unsigned int* dst, int dst_width, int dst_height, const unsigned int* src, int src_width, int src_height)
 {
-    // Check which keypad button is currently pressed by comparing against known codes
-    for (int i = 0; i < OVERLAY_HOTSPOT_COUNT; i++) {
-        if (overlay_hotspots[i].keypad_code == controller_value) {
-            return i;
+    for (int y = 0; y < dst_height; ++y) {
+        int sy0 = y * src_height / dst_height;
+        int sy1 = (y + 1) * src_height / dst_height;
+        for (int x = 0; x < dst_width; ++x) {
+            int sx0 = x * src_width / dst_width;
+            int sx1 = (x + 1) * src_width / dst_width;
+            unsigned int r = 0, g = 0, b = 0, n = 0;
+            for (int sy = sy0; sy < sy1; ++sy) {
+                for (int sx = sx0; sx < sx1; ++sx) {
+                    unsigned int c = src[sy * src_width + sx];
+                    r += (c >> 16) & 0xFF;
+                    g += (c >> 8) & 0xFF;
+                    b += c & 0xFF;
+                    n++;
+                }
+            }
+            dst[y * dst_width + x] = 0xFF000000 | ((r / n) << 16) | ((g / n) << 8) | (b / n);
         }
     }
-    return -1;
 }
 
-// Safe dual-screen function using proven patterns
-static void render_dual_screen(void)
+// Composite the static controller region (background, game overlay,
+// controller base, utility button outlines) into overlay_layer, scaled for
+// the layout; called when the overlay, controller base or layout changes,
+// not per frame
+static void build_overlay_layer(void)
 {
-    static int render_count = 0;
-    if (render_count == 0) {
-        printf("[RENDER_DUAL_SCREEN] Function called - dual_screen_enabled=%d\n", dual_screen_enabled);
-        fflush(stdout);
-    }
-    render_count++;
-    
-    if (!dual_screen_enabled) return;
-    // Allocate workspace buffer
-    if (!dual_screen_buffer) {
-        dual_screen_buffer = malloc(WORKSPACE_WIDTH * WORKSPACE_HEIGHT * sizeof(unsigned int));
-    }
-    if (!dual_screen_buffer) return;
-    unsigned int* dual_buffer = (unsigned int*)dual_screen_buffer;
-    // Defensive: check frame pointer
-    extern unsigned int frame[352 * 224];
-    int frame_valid = (frame != NULL);
-    int overlay_valid = (overlay_buffer != NULL);
-    // --- GAME SCREEN (Top: 704x448, scaled 2x from 352x224) ---
-    for (int y = 0; y < 448; ++y) {
-        int src_y = y / 2;  // Map to source row (0-223)
-        for (int x = 0; x < 704; ++x) {
-            int src_x = x / 2;  // Map to source column (0-351)
-            if (frame_valid && src_y < GAME_HEIGHT && src_x < GAME_WIDTH) {
-                dual_buffer[y * WORKSPACE_WIDTH + x] = frame[src_y * GAME_WIDTH + src_x];
-            } else {
-                dual_buffer[y * WORKSPACE_WIDTH + x] = 0xFF000000; // Black
-            }
+    unsigned int* full_layer;
+
+    free(overlay_layer);
+    overlay_layer = (unsigned int*)malloc(layout->layer_height * layout->width * sizeof(unsigned int));
+    if (!overlay_layer) return;
+    full_layer = overlay_layer;
+    if (layout->num != layout->den) {
+        full_layer = (unsigned int*)malloc(OVERLAY_LAYER_HEIGHT * WORKSPACE_WIDTH * sizeof(unsigned int));
+        if (!full_layer) {
+            free(overlay_layer);
+            overlay_layer = NULL;
+            return;
         }
     }
-    // --- CONTROLLER OVERLAY (Bottom: 704x620, layered) ---
-    // Fill background with deep charcoal (#1a1a1a = 0xFF1a1a1a in ARGB)
+    int overlay_valid = (overlay_buffer != NULL);
+    // Background is deep charcoal (#1a1a1a = 0xFF1a1a1a in ARGB)
     unsigned int background_color = 0xFF1a1a1a;
-    for (int y = 0; y < OVERLAY_HEIGHT; ++y) {
-        for (int x = 0; x < WORKSPACE_WIDTH; ++x) {
-            dual_buffer[(GAME_SCREEN_HEIGHT + y) * WORKSPACE_WIDTH + x] = background_color;
-        }
-    }
     
     // Layer 1 (back): Game-specific overlay (centered under controller base, top-aligned, 1:1 pixels)
     // Layer 2 (front): Static controller base (right-aligned, native resolution, 1:1 pixels)
@@ -480,7 +526,7 @@ static void render_dual_screen(void)
     // Game overlay centered horizontally within controller base region
     int game_overlay_x_offset = (controller_base_width - overlay_width) / 2;
     
-    for (int y = 0; y < OVERLAY_HEIGHT; ++y) {
+    for (int y = 0; y < OVERLAY_LAYER_HEIGHT; ++y) {
         for (int x = 0; x < WORKSPACE_WIDTH; ++x) {
             unsigned int pixel = background_color;  // Start with background color instead of black
             
@@ -517,7 +563,7 @@ static void render_dual_screen(void)
             }
             // Left side remains black
             
-            dual_buffer[(GAME_SCREEN_HEIGHT + y) * WORKSPACE_WIDTH + x] = pixel;
+            full_layer[y * WORKSPACE_WIDTH + x] = pixel;
         }
     }
     
@@ -533,9 +579,9 @@ static void render_dual_screen(void)
                 int y_top = GAME_SCREEN_HEIGHT + h->y;
                 int y_bottom = GAME_SCREEN_HEIGHT + h->y + h->height - 1;
                 if (y_top >= GAME_SCREEN_HEIGHT && y_top < WORKSPACE_HEIGHT)
-                    dual_buffer[y_top * WORKSPACE_WIDTH + x] = keypad_color;
+                    full_layer[(y_top - GAME_SCREEN_HEIGHT) * WORKSPACE_WIDTH + x] = keypad_color;
                 if (y_bottom >= GAME_SCREEN_HEIGHT && y_bottom < WORKSPACE_HEIGHT)
-                    dual_buffer[y_bottom * WORKSPACE_WIDTH + x] = keypad_color;
+                    full_layer[(y_bottom - GAME_SCREEN_HEIGHT) * WORKSPACE_WIDTH + x] = keypad_color;
             }
         }
         // Draw left and right borders
@@ -544,10 +590,10 @@ static void render_dual_screen(void)
                 int y_pos = GAME_SCREEN_HEIGHT + y;
                 if (y_pos >= GAME_SCREEN_HEIGHT && y_pos < WORKSPACE_HEIGHT) {
                     if (h->x >= 0 && h->x < WORKSPACE_WIDTH)
-                        dual_buffer[y_pos * WORKSPACE_WIDTH + h->x] = keypad_color;
+                        full_layer[y * WORKSPACE_WIDTH + h->x] = keypad_color;
                     int x_right = h->x + h->width - 1;
                     if (x_right >= 0 && x_right < WORKSPACE_WIDTH)
-                        dual_buffer[y_pos * WORKSPACE_WIDTH + x_right] = keypad_color;
+                        full_layer[y * WORKSPACE_WIDTH + x_right] = keypad_color;
                 }
             }
         }
@@ -565,9 +611,9 @@ static void render_dual_screen(void)
                 int y_top = GAME_SCREEN_HEIGHT + btn->y;
                 int y_bottom = GAME_SCREEN_HEIGHT + btn->y + btn->height - 1;
                 if (y_top >= GAME_SCREEN_HEIGHT && y_top < WORKSPACE_HEIGHT)
-                    dual_buffer[y_top * WORKSPACE_WIDTH + x] = utility_color;
+                    full_layer[(y_top - GAME_SCREEN_HEIGHT) * WORKSPACE_WIDTH + x] = utility_color;
                 if (y_bottom >= GAME_SCREEN_HEIGHT && y_bottom < WORKSPACE_HEIGHT)
-                    dual_buffer[y_bottom * WORKSPACE_WIDTH + x] = utility_color;
+                    full_layer[(y_bottom - GAME_SCREEN_HEIGHT) * WORKSPACE_WIDTH + x] = utility_color;
             }
         }
         // Draw left and right borders
@@ -576,18 +622,104 @@ static void render_dual_screen(void)
                 int y_pos = GAME_SCREEN_HEIGHT + y;
                 if (y_pos >= GAME_SCREEN_HEIGHT && y_pos < WORKSPACE_HEIGHT) {
                     if (btn->x >= 0 && btn->x < WORKSPACE_WIDTH)
-                        dual_buffer[y_pos * WORKSPACE_WIDTH + btn->x] = utility_color;
+                        full_layer[y * WORKSPACE_WIDTH + btn->x] = utility_color;
                     int x_right = btn->x + btn->width - 1;
                     if (x_right >= 0 && x_right < WORKSPACE_WIDTH)
-                        dual_buffer[y_pos * WORKSPACE_WIDTH + x_right] = utility_color;
+                        full_layer[y * WORKSPACE_WIDTH + x_right] = utility_color;
                 }
             }
         }
     }
     
+    if (full_layer != overlay_layer) {
+        scale_down(overlay_layer, layout->width, layout->layer_height, full_layer, WORKSPACE_WIDTH, OVERLAY_LAYER_HEIGHT);
+        free(full_layer);
+    }
+    overlay_layer_generation++;
+}
+
+// A hotspot in the controller region of the current layout, clipped to it
+static void layout_hotspot(const overlay_hotspot_t* h, int* x0, int* y0, int* x1, int* y1)
+{
+    *x0 = h->x * layout->num / layout->den;
+    *y0 = h->y * layout->num / layout->den;
+    *x1 = (h->x + h->width) * layout->num / layout->den;
+    *y1 = (h->y + h->height) * layout->num / layout->den;
+    if (*x0 < 0) *x0 = 0;
+    if (*y0 < 0) *y0 = 0;
+    if (*x1 > layout->width) *x1 = layout->width;
+    if (*y1 > layout->layer_height) *y1 = layout->layer_height;
+}
+
+// Detect which hotspot (if any) is currently pressed based on controller state
+// Returns hotspot index (0-11) or -1 if none pressed
+static int detect_pressed_hotspot(int controller_value)
+{
+    // Check which keypad button is currently pressed by comparing against known codes
+    for (int i = 0; i < OVERLAY_HOTSPOT_COUNT; i++) {
+        if (overlay_hotspots[i].keypad_code == controller_value) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+// Safe dual-screen function using proven patterns
+// pitch is the buffer's line length in pixels, state its two state words;
+// game is frame[] to scale up or NULL to convert the STIC output itself
+// (frameNative), which works whenever nothing was drawn over frame[]
+static void render_dual_screen(unsigned int *dual_buffer, int pitch, unsigned int *state, const unsigned int *game, unsigned int key)
+{
+    if (!dual_screen_enabled) return;
+    // --- GAME SCREEN (Top: 704x448, scaled 2x from 352x224; 1x in the compact layout) ---
+    if (layout->game_scale == 1) {
+        if (!game) {
+            STICConvertFrame(dual_buffer, pitch * sizeof(unsigned int), STICFrameFormat);
+        } else {
+            for (int y = 0; y < GAME_HEIGHT; ++y)
+                memcpy(dual_buffer + y * pitch, game + y * GAME_WIDTH, GAME_WIDTH * sizeof(unsigned int));
+        }
+    } else if (!game) {
+        STICConvertFrame2x(dual_buffer, pitch * sizeof(unsigned int), STICFrameFormat);
+    } else {
+        // double each line, then copy it to the line below
+        for (int y = 0; y < GAME_HEIGHT; ++y) {
+            unsigned int* line = dual_buffer + 2 * y * pitch;
+            const unsigned int* src = game + y * GAME_WIDTH;
+            for (int x = 0; x < GAME_WIDTH; ++x) {
+                line[2 * x] = src[x];
+                line[2 * x + 1] = src[x];
+            }
+            memcpy(line + pitch, line, 2 * GAME_WIDTH * sizeof(unsigned int));
+        }
+    }
+    // --- CONTROLLER OVERLAY (Bottom: 704x620, layered) ---
+    // The static layers come from overlay_layer, copied in only when the
+    // buffer doesn't hold the current layer yet; after that a frame only
+    // moves the hotspot highlight.
+    if (!overlay_layer) return;
+    unsigned int* controller_region = dual_buffer + layout->game_height * pitch;
+    int highlighted = (int)state[DUAL_SCREEN_HIGHLIGHT];
+    if (state[DUAL_SCREEN_LAYER] != overlay_layer_generation) {
+        // the part of the game screen area the game doesn't cover is blank
+        int game_width = GAME_WIDTH * layout->game_scale;
+        for (int y = 0; y < layout->game_height; ++y) {
+            int x0 = y < GAME_HEIGHT * layout->game_scale ? game_width : 0;
+            memset(dual_buffer + y * pitch + x0, 0, (layout->width - x0) * sizeof(unsigned int));
+        }
+        if (pitch == layout->width) {
+            memcpy(controller_region, overlay_layer, layout->layer_height * layout->width * sizeof(unsigned int));
+        } else {
+            for (int y = 0; y < layout->layer_height; ++y)
+                memcpy(controller_region + y * pitch, overlay_layer + y * layout->width, layout->width * sizeof(unsigned int));
+        }
+        state[DUAL_SCREEN_LAYER] = overlay_layer_generation;
+        highlighted = -1;
+    }
+    
     // Highlight hotspots - for both keyboard testing and active controller input
     // First, check if a key is pressed on right controller (player 0, port 0x1FE)
-    int current_key = Memory[0x1FE] ^ 0xFF;  // Invert because pressed bits are 1 in Memory
+    int current_key = key ^ 0xFF;  // Invert because pressed bits are 1 in Memory
     
     // Look for currently pressed key
     int active_hotspot = -1;
@@ -598,42 +730,48 @@ static void render_dual_screen(void)
         }
     }
     
+    if (active_hotspot == highlighted) return;
+    
+    int x0, y0, x1, y1;
+    
+    // Put back the layer under the old highlight
+    if (highlighted >= 0 && highlighted < OVERLAY_HOTSPOT_COUNT) {
+        layout_hotspot(&overlay_hotspots[highlighted], &x0, &y0, &x1, &y1);
+        for (int y = y0; y < y1 && x0 < x1; y++) {
+            memcpy(controller_region + y * pitch + x0, overlay_layer + y * layout->width + x0,
+                   (x1 - x0) * sizeof(unsigned int));
+        }
+    }
+    state[DUAL_SCREEN_HIGHLIGHT] = (unsigned int)active_hotspot;
+    
     // Highlight the active hotspot if any button is pressed
     if (active_hotspot >= 0 && active_hotspot < OVERLAY_HOTSPOT_COUNT) {
         overlay_hotspot_t *h = &overlay_hotspots[active_hotspot];
-        printf("[HOTSPOT_RENDER] Rendering highlight for hotspot %d at (%d,%d) size %dx%d\n",
-               active_hotspot, h->x, h->y, h->width, h->height);
         
         // Draw semi-transparent glow/fill over the hotspot
         unsigned int highlight_color = 0xAA00FF00;  // Semi-transparent yellow/lime (ARGB)
         
-        for (int y = h->y; y < h->y + h->height; y++) {
-            if (y >= 0 && y < OVERLAY_HEIGHT) {
-                int y_pos = GAME_SCREEN_HEIGHT + y;
-                if (y_pos >= GAME_SCREEN_HEIGHT && y_pos < WORKSPACE_HEIGHT) {
-                    for (int x = h->x; x < h->x + h->width; x++) {
-                        if (x >= 0 && x < WORKSPACE_WIDTH) {
-                            // Blend highlight with existing pixel
-                            unsigned int existing = dual_buffer[y_pos * WORKSPACE_WIDTH + x];
-                            unsigned int alpha = (highlight_color >> 24) & 0xFF;
-                            unsigned int inv_alpha = 255 - alpha;
-                            
-                            unsigned int r = ((highlight_color >> 16) & 0xFF);
-                            unsigned int g = ((highlight_color >> 8) & 0xFF);
-                            unsigned int b = (highlight_color & 0xFF);
-                            
-                            unsigned int existing_r = ((existing >> 16) & 0xFF);
-                            unsigned int existing_g = ((existing >> 8) & 0xFF);
-                            unsigned int existing_b = (existing & 0xFF);
-                            
-                            unsigned int blended_r = (r * alpha + existing_r * inv_alpha) / 255;
-                            unsigned int blended_g = (g * alpha + existing_g * inv_alpha) / 255;
-                            unsigned int blended_b = (b * alpha + existing_b * inv_alpha) / 255;
-                            
-                            dual_buffer[y_pos * WORKSPACE_WIDTH + x] = 0xFF000000 | (blended_r << 16) | (blended_g << 8) | blended_b;
-                        }
-                    }
-                }
+        layout_hotspot(h, &x0, &y0, &x1, &y1);
+        for (int y = y0; y < y1; y++) {
+            for (int x = x0; x < x1; x++) {
+                // Blend highlight with existing pixel
+                unsigned int existing = controller_region[y * pitch + x];
+                unsigned int alpha = (highlight_color >> 24) & 0xFF;
+                unsigned int inv_alpha = 255 - alpha;
+                
+                unsigned int r = ((highlight_color >> 16) & 0xFF);
+                unsigned int g = ((highlight_color >> 8) & 0xFF);
+                unsigned int b = (highlight_color & 0xFF);
+                
+                unsigned int existing_r = ((existing >> 16) & 0xFF);
+                unsigned int existing_g = ((existing >> 8) & 0xFF);
+                unsigned int existing_b = (existing & 0xFF);
+                
+                unsigned int blended_r = (r * alpha + existing_r * inv_alpha) / 255;
+                unsigned int blended_g = (g * alpha + existing_g * inv_alpha) / 255;
+                unsigned int blended_b = (b * alpha + existing_b * inv_alpha) / 255;
+                
+                controller_region[y * pitch + x] = 0xFF000000 | (blended_r << 16) | (blended_g << 8) | blended_b;
             }
         }
     }
@@ -669,6 +807,26 @@ int joypre0[20]; // joypad 0 previous state
 int joypre1[20]; // joypad 1 previous state
 
 bool paused = false;
+bool canDupe = false; // frontend accepts a NULL frame to repeat the last one
+unsigned int dualScreenKey; // right controller state the dual-screen buffer was drawn with
+bool dualScreenShown = false; // the frontend has a dual-screen frame to repeat
+bool wantRGB565 = false;   // pixel format option (single screen only)
+bool outputRGB565 = false; // frontend took RGB565, frames go out through frame565
+unsigned short frame565[352*224];
+bool frame565Current = false; // frame565 holds the STIC output of the last frame sent
+
+// Frame skip: FRAMESKIP_AUTO skips while the frontend's audio buffer runs
+// low, a number skips that many frames after each one shown.  Skipped
+// frames still run the STIC for its collisions but draw nothing, and go
+// to the frontend as a frame dupe: no frame skip unless it takes those.
+#define FRAMESKIP_AUTO      -1
+#define FRAMESKIP_THRESHOLD 33 // audio buffer occupancy (%) to skip under
+#define FRAMESKIP_MAX       4  // frames skipped in a row in auto mode
+int frameskip = 0;
+int frameskipCount = 0; // frames skipped since the last one shown
+bool audioBufferActive = false;
+unsigned audioBufferOccupancy = 0;
+bool audioBufferUnderrun = false;
 
 bool keyboardChange = false;
 bool keyboardDown = false;
@@ -689,6 +847,20 @@ unsigned int frameWidth = MaxWidth;
 unsigned int frameHeight = MaxHeight;
 unsigned int frameSize =  MaxWidth * MaxHeight; //78848
 
+#ifdef FREEINTV_PROFILE
+retro_log_printf_t Log;
+int profileInterval = 0; // frames between reports, 0 when profiling is off
+int profileFrames = 0;
+
+void ProfileLog(const char *line)
+{
+	if (Log)
+		Log(RETRO_LOG_INFO, "%s\n", line);
+	else
+		printf("%s\n", line);
+}
+#endif
+
 void quit(int state)
 {
 	Reset();
@@ -780,9 +952,232 @@ static void Keyboard(bool down, unsigned keycode,
 	}
 }
 
+static void audioBufferStatus(bool active, unsigned occupancy, bool underrun_likely)
+{
+	audioBufferActive = active;
+	audioBufferOccupancy = occupancy;
+	audioBufferUnderrun = underrun_likely;
+}
+
+static bool skipThisFrame(void)
+{
+	if (frameskip == FRAMESKIP_AUTO)
+		return audioBufferActive && (audioBufferUnderrun || audioBufferOccupancy < FRAMESKIP_THRESHOLD) && frameskipCount < FRAMESKIP_MAX;
+	return frameskipCount < frameskip;
+}
+
+// Render thread ("Render Thread" option): STICDrawFrame leaves the pixels
+// of each new frame to STICDrawDeferred, which runs on this thread along
+// with the dual-screen compositing while the cpu goes on with the next
+// frame.  renderSync picks the result up when the STIC needs its drawing
+// state back, at the next VBLANK, so frames are shown one frame late.
+bool renderChanged = false;    // renderSync put a new frame (or the clean one) in frame[]
+bool renderComposited = false; // and the render thread's composite in dual_screen_buffer
+bool renderRestore = false;    // frame[] was drawn over, put the clean frame back
+unsigned int renderDualKey;    // keypad state of that composite
+
+#ifdef FREEINTV_THREADS
+static pthread_t renderThread;
+static pthread_mutex_t renderLock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t renderCond = PTHREAD_COND_INITIALIZER;
+static bool renderStarted = false;
+static bool renderBusy = false;  // a frame was handed over and isn't done
+static bool renderDone = false;  // done, not picked up yet
+static bool renderQuit = false;
+static unsigned int renderKey;   // keypad state the frame is composited with
+
+static void *renderWorker(void *arg)
+{
+	pthread_mutex_lock(&renderLock);
+	while (!renderQuit)
+	{
+		if (!renderBusy)
+		{
+			pthread_cond_wait(&renderCond, &renderLock);
+			continue;
+		}
+		pthread_mutex_unlock(&renderLock);
+
+		STICDrawDeferred();
+		if (dual_screen_back)
+			render_dual_screen(dual_screen_back, layout->width, (unsigned int*)dual_screen_back + DUAL_SCREEN_STATE,
+				NULL, renderKey);
+
+		pthread_mutex_lock(&renderLock);
+		renderBusy = false;
+		renderDone = true;
+		pthread_cond_broadcast(&renderCond);
+	}
+	pthread_mutex_unlock(&renderLock);
+	return NULL;
+}
+
+// STICSync: wait for the render thread and take over its frame
+static void renderSync(void)
+{
+	bool done;
+	void *swap;
+
+	pthread_mutex_lock(&renderLock);
+	while (renderBusy)
+		pthread_cond_wait(&renderCond, &renderLock);
+	done = renderDone;
+	renderDone = false;
+	pthread_mutex_unlock(&renderLock);
+
+	if (done || renderRestore)
+	{
+		memcpy(frame, STICDeferredFrame, sizeof(frame));
+		renderChanged = true;
+		renderRestore = false;
+	}
+	if (done && dual_screen_back)
+	{
+		swap = dual_screen_buffer;
+		dual_screen_buffer = dual_screen_back;
+		dual_screen_back = swap;
+		renderComposited = true;
+		renderDualKey = renderKey;
+	}
+}
+
+// hand the frame STICDrawFrame left over to the render thread
+static void renderKick(void)
+{
+	if (dual_screen_enabled && !dual_screen_back)
+		dual_screen_back = dual_screen_alloc();
+	renderKey = Memory[0x1FE];
+
+	pthread_mutex_lock(&renderLock);
+	renderBusy = true;
+	pthread_cond_signal(&renderCond);
+	pthread_mutex_unlock(&renderLock);
+}
+
+static void renderStart(void)
+{
+	if (!renderStarted)
+	{
+		renderQuit = false;
+		renderStarted = pthread_create(&renderThread, NULL, renderWorker, NULL) == 0;
+	}
+	if (renderStarted)
+	{
+		STICSync = renderSync;
+		STICDeferred = 1;
+	}
+}
+
+static void renderStop(void)
+{
+	if (!renderStarted)
+		return;
+	renderSync();
+	STICDeferred = 0;
+	STICSync = NULL;
+
+	pthread_mutex_lock(&renderLock);
+	renderQuit = true;
+	pthread_cond_broadcast(&renderCond);
+	pthread_mutex_unlock(&renderLock);
+	pthread_join(renderThread, NULL);
+	renderStarted = false;
+}
+#endif
+
+static void get_av_info(struct retro_system_av_info *info);
+
+// Switch dual-screen layouts: the buffers are dropped and come back at the
+// new size, the controller region is scaled again and, once the game runs,
+// the frontend is told about the new geometry
+static void set_dual_layout(const dual_layout_t* next, bool running)
+{
+	struct retro_system_av_info info;
+
+	if (STICSync)
+		STICSync(); // the render thread may be compositing the old layout
+	free(dual_screen_buffer);
+	free(dual_screen_back);
+	dual_screen_buffer = NULL;
+	dual_screen_back = NULL;
+	renderComposited = false;
+	dualScreenShown = false;
+
+	layout = next;
+	if (overlay_layer)
+		build_overlay_layer();
+	if (running && dual_screen_enabled)
+	{
+		get_av_info(&info);
+		Environ(RETRO_ENVIRONMENT_SET_SYSTEM_AV_INFO, &info);
+	}
+}
+
+// Load what the dual screen draws: the controller base, the game's
+// overlay and the controller region composited from them
+static void load_dual_screen(void)
+{
+	load_controller_base();
+	if (current_rom_path[0])
+		load_overlay_for_rom(current_rom_path);
+	build_overlay_layer();
+}
+
+// Turn the dual screen on or off ("Dual Screen" option).  Its images and
+// buffers only exist while it's on, single screen doesn't pay for them.
+// Once the game runs the frontend is told about the new geometry.
+static void set_dual_screen(int enabled, bool running)
+{
+	struct retro_system_av_info info;
+
+	// the workspace is XRGB 8888 and the pixel format is only negotiated
+	// when the game loads: an RGB 565 session stays single screen until
+	// the core restarts
+	if (enabled && running && outputRGB565)
+		return;
+
+	if (STICSync)
+		STICSync(); // the render thread may be compositing
+	free(dual_screen_buffer);
+	free(dual_screen_back);
+	dual_screen_buffer = NULL;
+	dual_screen_back = NULL;
+	renderComposited = false;
+	dualScreenShown = false;
+	frame565Current = false;
+
+	dual_screen_enabled = enabled;
+	if (!enabled)
+	{
+		free(overlay_layer);
+		free(overlay_buffer);
+		free(controller_base);
+		overlay_layer = NULL;
+		overlay_buffer = NULL;
+		controller_base = NULL;
+		overlay_loaded = 0;
+		controller_base_loaded = 0;
+	}
+	else if (running)
+	{
+		load_dual_screen();
+	}
+	STICInvalidateFrame(); // the other output starts from a whole frame
+
+	if (running)
+	{
+		get_av_info(&info);
+		Environ(RETRO_ENVIRONMENT_SET_SYSTEM_AV_INFO, &info);
+	}
+}
+
 static void check_variables(bool first_run)
 {
 	struct retro_variable var = {0};
+	struct retro_audio_buffer_status_callback bufferStatus = { audioBufferStatus };
+	const dual_layout_t *next;
+	int dual;
+	unsigned i;
 
 	if (first_run)
 	{
@@ -798,7 +1193,94 @@ static void check_variables(bool first_run)
 			if (strcmp(var.value, "left") == 0)
 				controllerSwap = 1;
 		}
+
+		var.key   = "freeintvds_pixel_format";
+		var.value = NULL;
+		wantRGB565 = false;
+		if (Environ(RETRO_ENVIRONMENT_GET_VARIABLE, &var) && var.value)
+			wantRGB565 = strcmp(var.value, "rgb565") == 0;
+	}
+
+	var.key   = "freeintvds_frameskip";
+	var.value = NULL;
+	frameskip = 0;
+	if (Environ(RETRO_ENVIRONMENT_GET_VARIABLE, &var) && var.value)
+	{
+		if (strcmp(var.value, "auto") == 0)
+			frameskip = FRAMESKIP_AUTO;
+		else
+			frameskip = atoi(var.value); // "disabled" reads as 0
+	}
+	// auto needs the frontend to report its audio buffer
+	if (frameskip == FRAMESKIP_AUTO && !Environ(RETRO_ENVIRONMENT_SET_AUDIO_BUFFER_STATUS_CALLBACK, &bufferStatus))
+		frameskip = 0;
+	if (!canDupe)
+		frameskip = 0;
+	if (frameskip != FRAMESKIP_AUTO)
+	{
+		Environ(RETRO_ENVIRONMENT_SET_AUDIO_BUFFER_STATUS_CALLBACK, NULL);
+		audioBufferActive = false;
+	}
+	frameskipCount = 0;
+
+	var.key   = "freeintvds_dual_screen";
+	var.value = NULL;
+	dual = 1;
+	if (Environ(RETRO_ENVIRONMENT_GET_VARIABLE, &var) && var.value)
+		dual = strcmp(var.value, "disabled") != 0;
+
+	var.key   = "freeintvds_dual_layout";
+	var.value = NULL;
+	next = &dual_layouts[0];
+	if (Environ(RETRO_ENVIRONMENT_GET_VARIABLE, &var) && var.value)
+	{
+		for (i = 0; i < sizeof(dual_layouts) / sizeof(dual_layouts[0]); i++)
+			if (strcmp(var.value, dual_layouts[i].name) == 0)
+				next = &dual_layouts[i];
+	}
+	// one geometry change when both options change
+	if (next != layout)
+		set_dual_layout(next, !first_run && dual == dual_screen_enabled);
+	if (dual != dual_screen_enabled)
+		set_dual_screen(dual, !first_run);
+
+	var.key   = "freeintvds_stic_rendering";
+	var.value = NULL;
+	STICIncremental = 0;
+	if (Environ(RETRO_ENVIRONMENT_GET_VARIABLE, &var) && var.value)
+		STICIncremental = strcmp(var.value, "rows") == 0;
+
+#ifdef FREEINTV_THREADS
+	var.key   = "freeintvds_render_thread";
+	var.value = NULL;
+	if (Environ(RETRO_ENVIRONMENT_GET_VARIABLE, &var) && var.value && strcmp(var.value, "enabled") == 0)
+	{
+		if (!STICDeferred)
+		{
+			renderStart();
+			STICInvalidateFrame(); // the first frame goes to the thread
+		}
 	}
+	else if (STICDeferred)
+	{
+		renderStop();
+		STICInvalidateFrame(); // frame[] holds the thread's last frame, not sent yet
+	}
+#endif
+
+#ifdef FREEINTV_PROFILE
+	var.key   = "freeintvds_profile";
+	var.value = NULL;
+	profileInterval = 0;
+	if (Environ(RETRO_ENVIRONMENT_GET_VARIABLE, &var) && var.value)
+		profileInterval = atoi(var.value); // "disabled" reads as 0
+	if (profileInterval > 0 && !ProfileEnabled)
+	{
+		ProfileReset();
+		profileFrames = 0;
+	}
+	ProfileEnabled = profileInterval > 0;
+#endif
 }
 
 void retro_set_environment(retro_environment_t fn)
@@ -815,6 +1297,10 @@ void retro_init(void)
 	char execPath[PATH_MAX_LENGTH];
 	char gromPath[PATH_MAX_LENGTH];
 	struct retro_keyboard_callback kb = { Keyboard };
+#ifdef FREEINTV_PROFILE
+	struct retro_log_callback logging;
+	struct retro_perf_callback perf;
+#endif
 
 	// controller descriptors
 	struct retro_input_descriptor desc[] = {
@@ -859,6 +1345,20 @@ void retro_init(void)
 		{ 0 },
 	};
 
+#ifdef FREEINTV_PROFILE
+	if (Environ(RETRO_ENVIRONMENT_GET_LOG_INTERFACE, &logging))
+		Log = logging.log;
+	if (Environ(RETRO_ENVIRONMENT_GET_PERF_INTERFACE, &perf) && perf.get_time_usec)
+		ProfileTimer = perf.get_time_usec;
+#endif
+
+	if (!Environ(RETRO_ENVIRONMENT_GET_CAN_DUPE, &canDupe))
+		canDupe = false;
+
+#if defined(ABGR1555)
+	STICFrameFormat = STIC_XBGR8888; // red and blue swapped for the PS2 frontend
+#endif
+
 	// init buffers, structs
 	memset(frame, 0, frameSize);
 	OSD_setDisplay(frame, MaxWidth, MaxHeight);
@@ -876,9 +1376,6 @@ void retro_init(void)
 	if (SystemPath) {
 		strncpy(system_dir, SystemPath, sizeof(system_dir) - 1);
 		system_dir[sizeof(system_dir) - 1] = '\0';
-		
-		// Load static controller base image once at startup
-		load_controller_base();
 	}
 
 	// load exec
@@ -898,9 +1395,14 @@ bool retro_load_game(const struct retro_game_info *info)
 	check_variables(true);
 	LoadGame(info->path);
 	
-	// Load overlay using the path from info
-	if (dual_screen_enabled && info && info->path) {
-		load_overlay_for_rom(info->path);
+	// Keep the path, the overlay is loaded again when the dual screen is turned on
+	current_rom_path[0] = '\0';
+	if (info && info->path) {
+		strncpy(current_rom_path, info->path, sizeof(current_rom_path) - 1);
+		current_rom_path[sizeof(current_rom_path) - 1] = '\0';
+	}
+	if (dual_screen_enabled) {
+		load_dual_screen();
 	}
 	
 	return true;
@@ -908,6 +1410,9 @@ bool retro_load_game(const struct retro_game_info *info)
 
 void retro_unload_game(void)
 {
+#ifdef FREEINTV_THREADS
+	renderStop();
+#endif
 	quit(0);
 }
 
@@ -1122,11 +1627,57 @@ static void render_utility_buttons(unsigned int* buffer, int buf_width, int buf_
     }
 }
 
+// frame[] (with the OSD drawn over it) to RGB565, pitch in bytes
+static void frameTo565(unsigned short *dst, size_t pitch)
+{
+	int x, y;
+	unsigned int c;
+
+	for (y = 0; y < 224; y++, dst = (unsigned short *)((char *)dst + pitch))
+	{
+		for (x = 0; x < 352; x++)
+		{
+			c = frame[y*352 + x];
+			if (STICFrameFormat == STIC_XBGR8888)
+				c = ((c & 0xFF) << 16) | (c & 0xFF00) | ((c >> 16) & 0xFF);
+			dst[x] = ((c >> 8) & 0xF800) | ((c >> 5) & 0x07E0) | ((c >> 3) & 0x001F);
+		}
+	}
+}
+
+// The frontend's own frame memory (GET_CURRENT_SOFTWARE_FRAMEBUFFER), so a
+// frame can be drawn where the frontend wants it instead of being copied
+// there by Video.  NULL unless it's writable, in the pixel format we set
+// and big enough; its contents aren't kept from one frame to the next.
+static void *frontendFramebuffer(unsigned width, unsigned height, size_t *pitch)
+{
+	struct retro_framebuffer fb;
+	unsigned format = outputRGB565 ? RETRO_PIXEL_FORMAT_RGB565 : RETRO_PIXEL_FORMAT_XRGB8888;
+	size_t bytes = outputRGB565 ? sizeof(unsigned short) : sizeof(unsigned int);
+
+	memset(&fb, 0, sizeof(fb));
+	fb.width = width;
+	fb.height = height;
+	fb.access_flags = RETRO_MEMORY_ACCESS_WRITE;
+	if (!Environ(RETRO_ENVIRONMENT_GET_CURRENT_SOFTWARE_FRAMEBUFFER, &fb) || !fb.data)
+		return NULL;
+	if (fb.format != format || fb.width != width || fb.height != height || fb.pitch < width * bytes || fb.pitch % bytes)
+		return NULL;
+	*pitch = fb.pitch;
+	return fb.data;
+}
+
 void retro_run(void)
 {
 	int c, i, j, k, l;
 	int showKeypad0 = false;
 	int showKeypad1 = false;
+	bool overlaid = false; // OSD or keypad drawn into frame this time
+	bool skipped = false; // STIC only ran for its collisions
+	bool changed;         // frame[] differs from the last frame sent
+	void *fb;             // frontend frame memory, see frontendFramebuffer
+	const unsigned int *game; // what render_dual_screen scales up
+	size_t pitch;
 
 	bool options_updated  = false;
 	if (Environ(RETRO_ENVIRONMENT_GET_VARIABLE_UPDATE, &options_updated) && options_updated)
@@ -1257,8 +1808,21 @@ void retro_run(void)
 			keyboardChange = false;
 		}
 
-		// grab frame
+		// grab frame, or only its collisions when it won't be shown.  A
+		// frame with anything drawn over it is always shown, and drawn
+		// whole so the overlay doesn't go over an older picture
+		overlaid = showKeypad0 || showKeypad1 || joypad0[9]==1 || joypad1[9]==1 || intv_halt;
+		skipped = skipThisFrame() && !overlaid;
+		STICSkipFrame = skipped;
 		Run();
+		STICSkipFrame = 0;
+#ifdef FREEINTV_THREADS
+		if (STICDeferredPending)
+		{
+			STICDeferredPending = 0;
+			renderKick();
+		}
+#endif
 
 		// draw overlays
 		if(showKeypad0) { drawMiniKeypad(0, frame); }
@@ -1320,25 +1884,112 @@ void retro_run(void)
 		}
 	}
 
-	if (intv_halt)
+	// a halt during a skipped frame shows from the next one, drawn whole
+	if (intv_halt && !skipped)
 		OSD_drawTextBG(3, 5, "INTELLIVISION HALTED");
+
+	// anything drawn over the STIC output has to be sent, and the STIC
+	// can't reuse frame[] for the next one
+	overlaid = overlaid || paused || (intv_halt && !skipped);
+	if (overlaid)
+	{
+		STICInvalidateFrame();
+		renderRestore = STICDeferred;
+	}
+	// with the render thread frame[] is the frame renderSync picked up
+	changed = STICDeferred ? renderChanged : STICFrameChanged;
+	// the dual screen converts the STIC output itself unless frame[] has
+	// more on it or the render thread owns that output
+	game = (overlaid || STICDeferred) ? frame : NULL;
+	frameskipCount = skipped ? frameskipCount + 1 : 0;
 	
 	// Send frame to libretro - use dual-screen buffer if enabled
-	if (dual_screen_enabled) {
+	if (frameskipCount > 0) {
+		// skipped, the frontend keeps showing the last frame
+		if (dual_screen_enabled && dualScreenShown)
+			Video(NULL, layout->width, layout->height, sizeof(unsigned int) * layout->width);
+		else
+			Video(NULL, frameWidth, frameHeight, (outputRGB565 ? sizeof(unsigned short) : sizeof(unsigned int)) * frameWidth);
+	} else if (dual_screen_enabled && STICDeferred && renderComposited && !overlaid) {
+		// composited on the render thread
+		dualScreenKey = renderDualKey;
+		dualScreenShown = true;
+		Video(dual_screen_buffer, layout->width, layout->height, sizeof(unsigned int) * layout->width);
+	} else if (dual_screen_enabled && canDupe && !overlaid && !changed && dualScreenShown && Memory[0x1FE] == dualScreenKey) {
+		// the dual-screen buffer only changes with the game frame and the
+		// keypad highlight (right controller)
+		Video(NULL, layout->width, layout->height, sizeof(unsigned int) * layout->width); // frame dupe
+	} else if (dual_screen_enabled && (fb = frontendFramebuffer(layout->width, layout->height, &pitch)) != NULL) {
+		// composite straight into the frontend's memory, all of it since
+		// nothing of the last frame is kept there
+		unsigned int state[2] = { 0, (unsigned int)-1 };
+		PROFILE_BEGIN(PROFILE_DUAL_SCREEN);
+		render_dual_screen((unsigned int*)fb, pitch / sizeof(unsigned int), state, game, Memory[0x1FE]);
+		PROFILE_END(PROFILE_DUAL_SCREEN);
+		dualScreenKey = Memory[0x1FE];
+		dualScreenShown = true;
+		Video(fb, layout->width, layout->height, pitch);
+	} else if (dual_screen_enabled) {
 		// Update dual-screen buffer AFTER Run() updates the game frame
-		render_dual_screen();
+		if (!dual_screen_buffer)
+			dual_screen_buffer = dual_screen_alloc();
+		PROFILE_BEGIN(PROFILE_DUAL_SCREEN);
+		if (dual_screen_buffer)
+			render_dual_screen(dual_screen_buffer, layout->width, (unsigned int*)dual_screen_buffer + DUAL_SCREEN_STATE,
+				game, Memory[0x1FE]);
+		PROFILE_END(PROFILE_DUAL_SCREEN);
+		dualScreenKey = Memory[0x1FE];
+		dualScreenShown = dual_screen_buffer != NULL;
 		
 		// Only send dual buffer if it was successfully allocated
 		if (dual_screen_buffer) {
-			Video(dual_screen_buffer, WORKSPACE_WIDTH, WORKSPACE_HEIGHT, sizeof(unsigned int) * WORKSPACE_WIDTH);
+			Video(dual_screen_buffer, layout->width, layout->height, sizeof(unsigned int) * layout->width);
 		} else {
 			// Fallback to regular single screen if allocation failed
 			Video(frame, frameWidth, frameHeight, sizeof(unsigned int) * frameWidth);
 		}
+	} else if (canDupe && !overlaid && !changed) {
+		Video(NULL, frameWidth, frameHeight, (outputRGB565 ? sizeof(unsigned short) : sizeof(unsigned int)) * frameWidth); // frame dupe
+	} else if (outputRGB565) {
+		// the STIC output converts straight from its color indices, only
+		// a frame with the OSD or keypad on it has to come from frame[],
+		// and any frame while the render thread owns the indices.  Either
+		// goes into the frontend's memory when it has some to give.
+		fb = frontendFramebuffer(frameWidth, frameHeight, &pitch);
+		if (!fb) {
+			fb = frame565;
+			pitch = sizeof(unsigned short) * frameWidth;
+		}
+		if (overlaid || STICDeferred)
+			frameTo565((unsigned short *)fb, pitch);
+		else if (changed || fb != frame565 || !frame565Current)
+			STICConvertFrame(fb, pitch, STIC_RGB565);
+		// only an unchanged STIC frame converted into frame565 can be sent
+		// again as it is, a frame that went to the frontend's memory or had
+		// the OSD on it leaves frame565 behind
+		frame565Current = fb == frame565 && !overlaid && !STICDeferred;
+		Video(fb, frameWidth, frameHeight, pitch);
+	} else if (!overlaid && !STICDeferred && (fb = frontendFramebuffer(frameWidth, frameHeight, &pitch)) != NULL) {
+		// converting the color indices beats Video copying frame[]
+		STICConvertFrame(fb, pitch, STICFrameFormat);
+		Video(fb, frameWidth, frameHeight, pitch);
 	} else {
 		Video(frame, frameWidth, frameHeight, sizeof(unsigned int) * frameWidth);
 	}
+	if (frameskipCount == 0)
+	{
+		renderChanged = false;
+		renderComposited = false;
+	}
 
+#ifdef FREEINTV_PROFILE
+	if (ProfileEnabled && ++profileFrames >= profileInterval)
+	{
+		ProfileReport(ProfileLog, profileFrames);
+		ProfileReset();
+		profileFrames = 0;
+	}
+#endif
 }
 
 unsigned retro_get_region(void)
@@ -1360,11 +2011,11 @@ void retro_get_system_info(struct retro_system_info *info)
 	info->need_fullpath = true;
 }
 
-void retro_get_system_av_info(struct retro_system_av_info *info)
+// geometry (the dual-screen layout's workspace or the game screen) and timing
+static void get_av_info(struct retro_system_av_info *info)
 {
-    int pixelformat = RETRO_PIXEL_FORMAT_XRGB8888;
-    int width = dual_screen_enabled ? WORKSPACE_WIDTH : GAME_WIDTH;
-    int height = dual_screen_enabled ? WORKSPACE_HEIGHT : GAME_HEIGHT;
+    int width = dual_screen_enabled ? layout->width : GAME_WIDTH;
+    int height = dual_screen_enabled ? layout->height : GAME_HEIGHT;
     memset(info, 0, sizeof(*info));
     info->geometry.base_width   = width;
     info->geometry.base_height  = height;
@@ -1374,24 +2025,50 @@ void retro_get_system_av_info(struct retro_system_av_info *info)
     info->geometry.aspect_ratio = ((float)width) / ((float)height);
     info->timing.fps = DefaultFPS;
     info->timing.sample_rate = AUDIO_FREQUENCY;
-    Environ(RETRO_ENVIRONMENT_SET_PIXEL_FORMAT, &pixelformat);
+}
+
+void retro_get_system_av_info(struct retro_system_av_info *info)
+{
+    int pixelformat = RETRO_PIXEL_FORMAT_XRGB8888;
+    get_av_info(info);
+    // RGB565 halves what goes to the frontend; the dual-screen workspace
+    // stays 32 bit like its artwork
+    outputRGB565 = false;
+    if (wantRGB565 && !dual_screen_enabled) {
+        int rgb565 = RETRO_PIXEL_FORMAT_RGB565;
+        outputRGB565 = Environ(RETRO_ENVIRONMENT_SET_PIXEL_FORMAT, &rgb565);
+    }
+    if (!outputRGB565)
+        Environ(RETRO_ENVIRONMENT_SET_PIXEL_FORMAT, &pixelformat);
 }
 
 
 void retro_deinit(void)
 {
 	libretro_supports_option_categories = false;
+
+#ifdef FREEINTV_THREADS
+	renderStop();
+#endif
 	
 	// Clean up dual-screen buffers
 	if (dual_screen_buffer) {
 		free(dual_screen_buffer);
 		dual_screen_buffer = NULL;
 	}
+	if (dual_screen_back) {
+		free(dual_screen_back);
+		dual_screen_back = NULL;
+	}
 	
 	if (overlay_buffer) {
 		free(overlay_buffer);
 		overlay_buffer = NULL;
 	}
+	if (overlay_layer) {
+		free(overlay_layer);
+		overlay_layer = NULL;
+	}
 	
 	if (controller_base) {
 		free(controller_base);
@@ -1472,6 +2149,8 @@ bool retro_unserialize(const void *data, size_t size)
 	PSGUnserialize(&all->PSG);
 	ivoiceUnserialize(&all->ivoice);
 	memcpy(Memory, all->Memory, sizeof(Memory));
+	CP1610FlushCache();
+	STICFlushCache();
 	SR1 = all->SR1;
 	intv_halt = all->intv_halt;
 	return true;
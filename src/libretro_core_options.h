@@ -73,6 +73,114 @@ struct retro_core_option_v2_definition option_defs_us[] = {
       },
       "right"
    },
+   {
+      "freeintvds_pixel_format",
+      "Pixel Format (Restart)",
+      NULL,
+      "Format of the frames sent to the frontend in single screen mode. RGB 565 halves the video bandwidth; the dual screen layout is always XRGB 8888, so turning Dual Screen on in an RGB 565 session takes a restart.",
+      NULL,
+      NULL,
+      {
+         { "xrgb8888", "XRGB 8888" },
+         { "rgb565",   "RGB 565" },
+         { NULL, NULL },
+      },
+      "xrgb8888"
+   },
+   {
+      "freeintvds_frameskip",
+      "Frameskip",
+      NULL,
+      "Skip drawing frames to keep up on slow devices. Skipped frames still run the whole game, collisions included, only the picture is not drawn or sent. Needs a frontend that can repeat frames. 'Auto' skips when the frontend's audio buffer runs low.",
+      NULL,
+      NULL,
+      {
+         { "disabled", NULL },
+         { "auto", "Auto" },
+         { "1", "Skip 1 of 2 Frames" },
+         { "2", "Skip 2 of 3 Frames" },
+         { "3", "Skip 3 of 4 Frames" },
+         { NULL, NULL },
+      },
+      "disabled"
+   },
+   {
+      "freeintvds_dual_screen",
+      "Dual Screen",
+      NULL,
+      "Show the game above the controller artwork in one tall workspace for dual screen devices. When disabled only the game screen is sent and the artwork and workspace buffers are freed. Can be changed while a game runs, except that turning it on with the RGB 565 pixel format takes a restart.",
+      NULL,
+      NULL,
+      {
+         { "enabled",  NULL },
+         { "disabled", NULL },
+         { NULL, NULL },
+      },
+      "enabled"
+   },
+   {
+      "freeintvds_dual_layout",
+      "Dual Screen Layout",
+      NULL,
+      "Size of the dual screen workspace. 'Full' is 1024x1486 with the artwork at its own size. 'Medium' (704x1021) and 'Compact' (352x510) scale the controller artwork down once when the game is loaded, which cuts the video bandwidth to a half or an eighth for slower devices.",
+      NULL,
+      NULL,
+      {
+         { "full",    "Full" },
+         { "medium",  "Medium" },
+         { "compact", "Compact" },
+         { NULL, NULL },
+      },
+      "full"
+   },
+   {
+      "freeintvds_stic_rendering",
+      "STIC Rendering",
+      NULL,
+      "'Per Card Row' draws each row of cards while the STIC displays it, from the registers and BACKTAB as they are at that time, instead of all at the end of the frame. Shows games that change the screen mid-frame as they look on the console and spreads the work over the frame.",
+      NULL,
+      NULL,
+      {
+         { "frame", "End of Frame" },
+         { "rows",  "Per Card Row" },
+         { NULL, NULL },
+      },
+      "frame"
+   },
+#ifdef FREEINTV_THREADS
+   {
+      "freeintvds_render_thread",
+      "Render Thread",
+      NULL,
+      "Draw the picture and the dual screen layout on a second thread while the next frame is emulated. Faster on multi-core devices, shows frames one frame later. Overrides 'Per Card Row' STIC rendering.",
+      NULL,
+      NULL,
+      {
+         { "disabled", NULL },
+         { "enabled",  NULL },
+         { NULL, NULL },
+      },
+      "disabled"
+   },
+#endif
+#ifdef FREEINTV_PROFILE
+   {
+      "freeintvds_profile",
+      "Profiling",
+      NULL,
+      "Count executed instructions, memory accesses and time spent per subsystem, and write a report to the log every N frames. Only in builds made with FREEINTV_PROFILE=1.",
+      NULL,
+      NULL,
+      {
+         { "disabled", NULL },
+         { "60",  "Every 60 Frames" },
+         { "300", "Every 300 Frames" },
+         { "600", "Every 600 Frames" },
+         { NULL, NULL },
+      },
+      "disabled"
+   },
+#endif
    { NULL, NULL, NULL, NULL, NULL, NULL, {{0}}, NULL },
 };
 
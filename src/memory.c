@@ -22,9 +22,15 @@
 #include "stic.h"
 #include "psg.h"
 #include "ivoice.h"
+#include "cp1610.h"
+#include "profile.h"
 
 unsigned int Memory[0x10000];
 
+unsigned int MemoryWrites;        // count of writeMem calls
+unsigned int MemoryVolatileReads; // count of reads that can change without a write (Intellivoice)
+unsigned int STICGeneration;      // count of writes that changed what the STIC displays
+
 int stic_and[64] = {
     0x07ff, 0x07ff, 0x07ff, 0x07ff, 0x07ff, 0x07ff, 0x07ff, 0x07ff,
     0x0fff, 0x0fff, 0x0fff, 0x0fff, 0x0fff, 0x0fff, 0x0fff, 0x0fff,
@@ -47,106 +53,175 @@ int stic_or[64] = {
     0x3fff, 0x3fff, 0x3fff, 0x3fff, 0x3fff, 0x3fff, 0x3fff, 0x3fff,
 };
 
-void writeMem(int adr, int val) // Write (should handle hooks/alias)
+// Memory bus, one entry per 256-word page.  Plain RAM and ROM are
+// accessed through host pointers into Memory; pages with side effects
+// (STIC, Intellivoice, PSG/controllers, GRAM aliases) go through
+// handlers.  A page with no write pointer and no write handler is ROM.
+struct MemoryPage {
+    unsigned int *read;
+    unsigned int *write;
+    int (*readHandler)(int adr);
+    void (*writeHandler)(int adr, int val);
+};
+
+struct MemoryPage MemoryPages[0x100];
+
+int readSTIC(int adr) // STIC registers 0x00-0x3F and their aliases
 {
-    val &= 0xFFFF;
-    adr &= 0xFFFF;
-    
-    // Ignore writes to protected ROM spaces
-    // Note: B17 Bomber manages to write on EXEC ROM (it will crash if unprotected)
-    switch (adr >> 11) {
-        case 0x02:  /* Exec ROM */
-        case 0x03:
-        case 0x06:  /* GROM */
-        case 0x0a:  /* 5000-57FF */
-        case 0x0b:  /* 5800-5FFF */
-        case 0x0c:  /* 6000-67FF */
-        case 0x0d:  /* 6800-6FFF */
-        case 0x14:  /* A000-A7FF */
-        case 0x15:  /* A800-AFFF */
-        case 0x16:  /* B000-B7FF */
-        case 0x1a:  /* D000-D7FF */
-        case 0x1b:  /* D800-DFFF */
-        case 0x1c:  /* E000-E7FF */
-        case 0x1d:  /* E800-EFFF */
-        case 0x1e:  /* F000-F7FF */
-            return; /* Ignore */
-        case 0x07:  /* GRAM 3800-3fff */
-        case 0x0f:  /* GRAM 7800-7fff */
-        case 0x17:  /* GRAM B800-BFFF */
-        case 0x1f:  /* GRAM F800-FFFF */
-            if (stic_gram != 0) {
-                // GRAM is 8-bit memory
-                // Note: Without the AND 0xff, Tower of Doom fails as it builds
-                // map from GRAM.
-                Memory[adr & 0x39FF] = val & 0xff;
-            }
-            return;
+    if (stic_reg != 0 && (adr & 0x3f) == 0x21)
+        STICMode = 1;   // Color Stack mode
+    if (adr >= 0x4000)
+        return 0xffff;
+    if (stic_reg == 0)  // Return trash
+        return adr & 0x0e;
+    adr &= 0x3f;
+    return (Memory[adr] & stic_and[adr]) | stic_or[adr];
+}
+
+void writeSTIC(int adr, int val)
+{
+    if (stic_reg != 0) {
+        adr &= 0x3f;
+        // STIC Display Enable
+        if (adr == 0x20)
+            DisplayEnabled = 1;
+        // STIC Mode Select
+        if (adr == 0x21)
+            STICMode = 0;   // Foreground/Background mode
+        val = (val & stic_and[adr]) | stic_or[adr];
+        // collision registers are results, not inputs
+        if (Memory[adr] != val && (adr < 0x18 || adr > 0x1F))
+            STICGeneration++;
+        Memory[adr] = val;
     }
+}
+
+int readPage00(int adr) // STIC, Intellivoice
+{
     if (adr == 0x80 || adr == 0x81) {
+        MemoryVolatileReads++;
+        ivoice_sync();
+        return ivoice_rd(adr & 1);
+    }
+    if (adr < 0x40)
+        return readSTIC(adr);
+    return Memory[adr];
+}
+
+void writePage00(int adr, int val)
+{
+    if (adr == 0x80 || adr == 0x81) {
+        ivoice_sync();
         ivoice_wr(adr & 1, val);
         return;
     }
-    if(adr>=0x100 && adr<=0x1FF)
+    if (adr < 0x40) {
+        writeSTIC(adr, val);
+        return;
+    }
+    Memory[adr] = val;
+    CP1610Invalidate(adr);
+}
+
+int readPage01(int adr) // 8-bit scratch ram, PSG, controllers
+{
+    return Memory[adr] & 0xFF;
+}
+
+void writePage01(int adr, int val)
+{
+    val = val & 0xFF;
+    //PSG Registers
+    if(adr>=0x01F0 && adr<=0x1FD)
     {
-        val = val & 0xFF;
+        PSGSync(); // samples up to now use the old register values
         Memory[adr] = val;
-        //PSG Registers
-        if(adr>=0x01F0 && adr<=0x1FD)
-        {
-            PSGNotify(adr, val);
-        }
+        PSGNotify(adr, val);
         return;
     }
-    
-    // STIC access
-    if ((adr & 0x3fc0) == 0x0000) {
-        if (stic_reg != 0) {
-            adr &= 0x3f;
-            // STIC Display Enable
-            if (adr == 0x20)
-                DisplayEnabled = 1;
-            // STIC Mode Select
-            if (adr == 0x21)
-                STICMode = 0;   // Foreground/Background mode
-            Memory[adr] = (val & stic_and[adr]) | stic_or[adr];
-        }
+    Memory[adr] = val;
+    CP1610Invalidate(adr);
+}
+
+void writePage02(int adr, int val) // BACKTAB 0x200-0x2EF, stack
+{
+    if (Memory[adr] != val && adr < 0x2F0)
+        STICGeneration++;
+    Memory[adr] = val;
+    CP1610Invalidate(adr);
+}
+
+int readSTICAlias(int adr) // 0x4000, 0x8000, 0xC000 pages start with STIC aliases
+{
+    if ((adr & 0xc0) == 0)
+        return readSTIC(adr);
+    return Memory[adr];
+}
+
+void writeSTICAlias(int adr, int val)
+{
+    if ((adr & 0xc0) == 0) {
+        writeSTIC(adr, val);
         return;
     }
-    
     Memory[adr] = val;
-    
+    CP1610Invalidate(adr);
+}
+
+void writeGRAM(int adr, int val)
+{
+    if (stic_gram != 0) {
+        // GRAM is 8-bit memory
+        // Note: Without the AND 0xff, Tower of Doom fails as it builds
+        // map from GRAM.
+        if (Memory[adr & 0x39FF] != (val & 0xff)) {
+            STICGeneration++;
+            STICInvalidateGRAM(adr);
+        }
+        Memory[adr & 0x39FF] = val & 0xff;
+        CP1610Invalidate(adr & 0x39FF);
+    }
+}
+
+void writeMem(int adr, int val) // Write (should handle hooks/alias)
+{
+    struct MemoryPage *page;
+
+    val &= 0xFFFF;
+    adr &= 0xFFFF;
+    MemoryWrites++;
+    PROFILE_WRITE(adr);
+    page = &MemoryPages[adr >> 8];
+    if (page->write != NULL) {
+        page->write[adr & 0xFF] = val;
+        CP1610Invalidate(adr);
+        return;
+    }
+    if (page->writeHandler != NULL)
+        page->writeHandler(adr, val);
 }
 
 int readMem(int adr) // Read (should handle hooks/alias)
 {
-	// It's safe to map ROM over GRAM aliases
+    struct MemoryPage *page;
 
-    int val;
-    
     adr &= 0xffff;
-    if (adr == 0x80 || adr == 0x81)
-        return ivoice_rd(adr & 1);
-    // STIC access
-    if ((adr & 0x3fc0) == 0x0000) {
-        if (stic_reg != 0 && (adr & 0x3f) == 0x21)
-            STICMode = 1;   // Color Stack mode
-        if (adr >= 0x4000)
-            return 0xffff;
-        if (stic_reg == 0)  // Return trash
-            return adr & 0x0e;
-        adr &= 0x3f;
-        val = (Memory[adr] & stic_and[adr]) | stic_or[adr];
-        return val;
-	}
-    val = Memory[adr];
-
-	if(adr>=0x100 && adr<=0x1FF)
-	{
-		val = val & 0xFF;
-	}
+    PROFILE_READ(adr);
+    page = &MemoryPages[adr >> 8];
+    if (page->read != NULL)
+        return page->read[adr & 0xFF];
+    return page->readHandler(adr);
+}
 
-	return val;
+void MemoryMap(int start, int stop, int (*readHandler)(int), void (*writeHandler)(int, int), int writable)
+{
+    int i;
+    for (i = start >> 8; i <= (stop >> 8); i++) {
+        MemoryPages[i].read = readHandler ? NULL : &Memory[i << 8];
+        MemoryPages[i].write = (writable && !writeHandler) ? &Memory[i << 8] : NULL;
+        MemoryPages[i].readHandler = readHandler;
+        MemoryPages[i].writeHandler = writeHandler;
+    }
 }
 
 void MemoryInit()
@@ -173,4 +248,26 @@ void MemoryInit()
 	for(i=0x6000; i<=0xFFFF; i++) { Memory[i] = 0xFFFF; }
 	Memory[0x1FE] = 0xFF; // Controller R
 	Memory[0x1FF] = 0xFF; // Controller L
+
+	MemoryMap(0x0000, 0xFFFF, NULL, NULL, 1); // RAM
+	MemoryMap(0x0000, 0x00FF, readPage00, writePage00, 1);
+	MemoryMap(0x0100, 0x01FF, readPage01, writePage01, 1);
+	MemoryMap(0x0200, 0x02FF, NULL, writePage02, 1);
+	MemoryMap(0x4000, 0x40FF, readSTICAlias, writeSTICAlias, 1);
+	MemoryMap(0x8000, 0x80FF, readSTICAlias, writeSTICAlias, 1);
+	MemoryMap(0xC000, 0xC0FF, readSTICAlias, writeSTICAlias, 1);
+	// Ignore writes to protected ROM spaces
+	// Note: B17 Bomber manages to write on EXEC ROM (it will crash if unprotected)
+	MemoryMap(0x1000, 0x1FFF, NULL, NULL, 0); // Exec ROM
+	MemoryMap(0x3000, 0x37FF, NULL, NULL, 0); // GROM
+	MemoryMap(0x5000, 0x6FFF, NULL, NULL, 0);
+	MemoryMap(0xA000, 0xB7FF, NULL, NULL, 0);
+	MemoryMap(0xD000, 0xF7FF, NULL, NULL, 0);
+	MemoryMap(0x3800, 0x3FFF, NULL, writeGRAM, 1); // GRAM and its aliases
+	MemoryMap(0x7800, 0x7FFF, NULL, writeGRAM, 1);
+	MemoryMap(0xB800, 0xBFFF, NULL, writeGRAM, 1);
+	MemoryMap(0xF800, 0xFFFF, NULL, writeGRAM, 1);
+
+	CP1610FlushCache();
+	STICFlushCache();
 }
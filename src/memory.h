@@ -20,10 +20,22 @@
 
 extern unsigned int Memory[0x10000];
 
+// Bumped by writeMem and by reads of Intellivoice status, the cpu uses
+// them to prove a loop can't see anything change (idle loop detection)
+extern unsigned int MemoryWrites;
+extern unsigned int MemoryVolatileReads;
+
+// Bumped by writes that change STIC registers (other than collisions),
+// BACKTAB or GRAM; the STIC reuses its last frame while it is unchanged
+extern unsigned int STICGeneration;
+
 void MemoryInit(void);
 
 int readMem(int adr);
 
 void writeMem(int adr, int val);
 
+// map start-stop to Memory with optional read/write handlers, writable: 0 for ROM
+void MemoryMap(int start, int stop, int (*readHandler)(int), void (*writeHandler)(int, int), int writable);
+
 #endif
@@ -0,0 +1,117 @@
+/*
+	This file is part of FreeIntv.
+
+	FreeIntv is free software; you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation; either version 2 of the License, or
+	(at your option) any later version.
+
+	FreeIntv is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License along
+	with FreeIntv; if not, write to the Free Software Foundation, Inc.,
+	51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+#include "profile.h"
+
+#ifdef FREEINTV_PROFILE
+
+#include <stdio.h>
+#include <string.h>
+
+#define PROFILE_TOP_OPCODES 16 // mnemonics listed in a report
+
+extern const char *Nmemonic[0x400];
+
+int ProfileEnabled = 0;
+
+unsigned int ProfileOpcodes[0x400];
+unsigned int ProfileReads[16];
+unsigned int ProfileWrites[16];
+
+int64_t ProfileStart[PROFILE_SECTIONS];
+int64_t ProfileTime[PROFILE_SECTIONS];
+
+int64_t ProfileNoTimer(void) { return 0; }
+
+int64_t (*ProfileTimer)(void) = ProfileNoTimer;
+
+// cpu overlaps psg and ivoice: register accesses catch those up from
+// inside CP1610Run, and that time counts in both sections
+const char *ProfileSectionName[PROFILE_SECTIONS] = {
+	"cpu", "stic", "psg", "ivoice", "dual screen"
+};
+
+void ProfileReset(void)
+{
+	memset(ProfileOpcodes, 0, sizeof(ProfileOpcodes));
+	memset(ProfileReads, 0, sizeof(ProfileReads));
+	memset(ProfileWrites, 0, sizeof(ProfileWrites));
+	memset(ProfileTime, 0, sizeof(ProfileTime));
+}
+
+void ProfileReport(void (*print)(const char *line), int frames)
+{
+	// opcodes added up per mnemonic, Nmemonic points at the same
+	// string for every opcode of an instruction
+	const char *name[0x400];
+	double count[0x400];
+	double total = 0.0;
+	char line[256];
+	int classes = 0;
+	int i, j;
+
+	if(frames < 1) { frames = 1; }
+
+	snprintf(line, sizeof(line), "[PROFILE] %d frames", frames);
+	print(line);
+
+	for(i=0; i<PROFILE_SECTIONS; i++)
+	{
+		snprintf(line, sizeof(line), "[PROFILE] %-12s %8.3f ms/frame", ProfileSectionName[i],
+			ProfileTime[i] / 1000.0 / frames);
+		print(line);
+	}
+	print("[PROFILE] (cpu includes the psg/ivoice catch-ups done on register access)");
+
+	for(i=0; i<0x400; i++)
+	{
+		if(ProfileOpcodes[i]==0 || Nmemonic[i]==NULL) { continue; }
+		total += ProfileOpcodes[i];
+		for(j=0; j<classes && name[j]!=Nmemonic[i]; j++) { }
+		if(j==classes) { name[classes] = Nmemonic[i]; count[classes] = 0.0; classes++; }
+		count[j] += ProfileOpcodes[i];
+	}
+	snprintf(line, sizeof(line), "[PROFILE] instructions %.0f per frame", total / frames);
+	print(line);
+	for(i=0; i<classes && i<PROFILE_TOP_OPCODES; i++)
+	{
+		// selection sort, only the top of the list is printed
+		for(j=i+1; j<classes; j++)
+		{
+			if(count[j] > count[i])
+			{
+				const char *n = name[i];
+				double c = count[i];
+				name[i] = name[j]; count[i] = count[j];
+				name[j] = n; count[j] = c;
+			}
+		}
+		snprintf(line, sizeof(line), "[PROFILE]   %s %10.0f %5.1f%%", name[i], count[i] / frames,
+			100.0 * count[i] / total);
+		print(line);
+	}
+
+	for(i=0; i<16; i++)
+	{
+		if(ProfileReads[i]==0 && ProfileWrites[i]==0) { continue; }
+		snprintf(line, sizeof(line), "[PROFILE] %04X-%04X read %8.0f write %8.0f per frame",
+			i<<12, (i<<12) | 0xFFF, (double)ProfileReads[i] / frames, (double)ProfileWrites[i] / frames);
+		print(line);
+	}
+}
+
+#endif
@@ -0,0 +1,70 @@
+#ifndef PROFILE_H
+#define PROFILE_H
+/*
+	This file is part of FreeIntv.
+
+	FreeIntv is free software; you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation; either version 2 of the License, or
+	(at your option) any later version.
+
+	FreeIntv is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License along
+	with FreeIntv; if not, write to the Free Software Foundation, Inc.,
+	51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+// Profiling counters: build with FREEINTV_PROFILE=1 and turn them on with
+// the "Profiling" core option.  Without FREEINTV_PROFILE the macros are
+// empty and nothing is compiled in.
+
+#include <stdint.h>
+
+enum {
+	PROFILE_CPU,         // CP1610Run, includes the PSG/ivoice time of catch-ups on register access
+	PROFILE_STIC,        // STICDrawFrame
+	PROFILE_PSG,         // PSGTick
+	PROFILE_IVOICE,      // ivoice_tk
+	PROFILE_DUAL_SCREEN, // render_dual_screen
+	PROFILE_SECTIONS
+};
+
+#ifdef FREEINTV_PROFILE
+
+extern int ProfileEnabled;
+
+extern unsigned int ProfileOpcodes[0x400]; // instructions executed per opcode
+extern unsigned int ProfileReads[16];      // readMem calls per 4K region
+extern unsigned int ProfileWrites[16];     // writeMem calls per 4K region
+
+extern int64_t ProfileStart[PROFILE_SECTIONS];
+extern int64_t ProfileTime[PROFILE_SECTIONS]; // microseconds
+
+extern int64_t (*ProfileTimer)(void); // microsecond clock (frontend perf interface)
+
+#define PROFILE_OPCODE(op)  do { if(ProfileEnabled) { ProfileOpcodes[op]++; } } while(0)
+#define PROFILE_READ(adr)   do { if(ProfileEnabled) { ProfileReads[(adr)>>12]++; } } while(0)
+#define PROFILE_WRITE(adr)  do { if(ProfileEnabled) { ProfileWrites[(adr)>>12]++; } } while(0)
+#define PROFILE_BEGIN(sec)  do { if(ProfileEnabled) { ProfileStart[sec] = ProfileTimer(); } } while(0)
+#define PROFILE_END(sec)    do { if(ProfileEnabled) { ProfileTime[sec] += ProfileTimer() - ProfileStart[sec]; } } while(0)
+
+void ProfileReset(void);
+
+// print a summary of the counters, one line per call to print
+void ProfileReport(void (*print)(const char *line), int frames);
+
+#else
+
+#define PROFILE_OPCODE(op)  do { } while(0)
+#define PROFILE_READ(adr)   do { } while(0)
+#define PROFILE_WRITE(adr)  do { } while(0)
+#define PROFILE_BEGIN(sec)  do { } while(0)
+#define PROFILE_END(sec)    do { } while(0)
+
+#endif
+
+#endif
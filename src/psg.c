@@ -21,6 +21,8 @@
 #include <stdint.h>
 #include "psg.h"
 #include "memory.h"
+#include "cp1610.h"
+#include "profile.h"
 
 int Volume[16] = { 0, 92, 128, 192, 256, 384, 512, 768, 1024, 1536, 2048, 3072, 4096, 6144, 8192, 10922 };
 
@@ -57,6 +59,8 @@ int PSGBufferPos;
 
 int Ticks; // CPU cycles not yet processed
 
+unsigned int PSGClock; // CP1610Clock value the PSG has been ticked up to
+
 int CountA; // countdowns for tone generators
 int CountB; // used to modulate square-wave
 int CountC; // according to Channel Period
@@ -224,6 +228,18 @@ void PSGNotify(int adr, int val) // PSG Registers Modified 0x01F0-0x1FD (called
 	}
 }
 
+void PSGSync(void) // catch up with the cpu (before a register write and at end of frame)
+{
+	int ticks = CP1610Clock - PSGClock;
+	if(ticks > 0)
+	{
+		PROFILE_BEGIN(PROFILE_PSG);
+		PSGTick(ticks);
+		PROFILE_END(PROFILE_PSG);
+		PSGClock = CP1610Clock;
+	}
+}
+
 void PSGTick(int ticks) // adds 1 sound sample per 4 cpu cycles to the buffer
 {
 	int16_t sample;
@@ -64,6 +64,7 @@ void PSGUnserialize(const struct PSGserialized *);
 void PSGInit(void); 
 void PSGFrame(void); // Notify New Frame
 void PSGTick(int ticks); // ticks PSG some number of cpu cycles 
+void PSGSync(void); // ticks PSG up to CP1610Clock
 void PSGNotify(int adr, int val); // updates PSG on register change
 
 
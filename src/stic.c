@@ -22,12 +22,15 @@
 
 #include <stdio.h>
 #include <string.h>
+#include <stdint.h>
 
 void drawBackground(void);
 void drawSprites(int scanline);
 void drawBorder(int scanline);
 void drawBackgroundFGBG(int scanline);
 void drawBackgroundColorStack(int scanline);
+void collSet(uint64_t *mask, int x, unsigned int bits, int count);
+unsigned int spreadBits(unsigned int bits);
 
 // Video chip: TMS9927 AY-3-8900-1
 // http://spatula-city.org/~im14u2c/intv/jzintv-1.0-beta3/doc/programming/stic.txt
@@ -44,9 +47,12 @@ int phase_len;
 int DisplayEnabled;
 
 unsigned int frame[352*224];
+unsigned char frameNative[176*224]; // STIC output, one color index per pixel, two half-lines per scanline
+int STICFrameFormat = STIC_XRGB8888; // pixel format of frame
 
-unsigned int scanBuffer[768]; // buffer for current scanline (352+32)*2
-unsigned int collBuffer[768]; // buffer for collision -- made larger than needed to save checks
+unsigned char scanBuffer[384]; // buffer for current scanline, two half-lines of 176+16
+uint64_t collMask[2][10][4]; // collision masks for the two half-lines, one per source (one word spare)
+int halfLines; // 1 when the second half-line differs from the first (half-height MOBs)
 
 int delayH = 0; // Horizontal Delay
 int delayV = 0; // Vertical Delay
@@ -55,31 +61,107 @@ int extendTop = 0;
 int extendLeft = 0;
 
 unsigned int CSP; // Color Stack Pointer
-unsigned int fgcard[20]; // cached colors for cards on current row
+unsigned int fgcard[20]; // cached color indices for cards on current row
 unsigned int bgcard[20]; // (used for normal color stack mode)
-#if defined(ABGR1555)
-unsigned int color7 = 0xFFFCFF; // Copy of color 7 (for color squares mode)
-unsigned int colors[16] =
-{
-	0x05000C, /* 0x000000; */ // Black
-	0xFF2D00, /* 0x0000FF; */ // Blue
-	0x003EFF, /* 0xFF0000; */ // Red
-	0x64D4C9, /* 0xCBFF65; */ // Tan
-	0x0F7800, /* 0x007F00; */ // Dark Green
-	0x20A700, /* 0x00FF00; */ // Light Green 
-	0x27EAFA, /* 0xFFFF00; */ // Yellow
-	0xFFFCFF, /* 0xFFFFFF; */ // White
-	0xA8A8A7, /* 0x7F7F7F; */ // Gray
-	0xFFCB5A, /* 0x00FFFF; */ // Cyan
-	0x00A6FF, /* 0xFF9F00; */ // Orange
-	0x00583C, /* 0x7F7F00; */ // Brown
-	0x7632FF, /* 0xFF3FFF; */ // Pink
-	0xFF95BD, /* 0x7F7FFF; */ // Violet
-	0x30CD6C, /* 0x7FFF00; */ // Bright green
-	0x7D1AC8  /* 0xFF007F; */ // Magenta
+
+// Decoded cards, one entry per BACKTAB position.  An entry holds the
+// eight graphic rows of its card and its colors, so a background scanline
+// is one expandRow call per card instead of BACKTAB, color and graphic
+// address decoding.  The BACKTAB word, the color stack color and the mode
+// are the key, GRAM writes bump a per-card generation (STICInvalidateGRAM)
+// that is part of it too.  Color squares are not cached.
+struct CardCacheEntry {
+    int valid;
+    int card;                   // BACKTAB word
+    unsigned int mode;          // STICMode the entry was built in
+    unsigned int bgcolor;       // background color index (from the color stack in color stack mode)
+    unsigned int gram;          // GRAMGeneration of the card, GRAM cards only
+    unsigned int fgcolor;
+    unsigned int gdata[8];      // card graphic rows
 };
-#else
-unsigned int color7 = 0xFFFCFF; // Copy of color 7 (for color squares mode)
+
+struct CardCacheEntry CardCache[240];
+unsigned int GRAMGeneration[64];
+
+// What the drawing code reads: Memory, GRAMGeneration and STICMode, or the
+// snapshot of them for a deferred frame
+unsigned int *drawMemory = Memory;
+unsigned int *drawGRAM = GRAMGeneration;
+unsigned int drawMode;
+int drawPixels; // 0 to only find the collisions
+
+// What the last frame was drawn from.  While STICGeneration, the mode and
+// the display enable are unchanged frame[] is still correct; only the
+// collision bits the frame produced are set again, as the cpu clears them.
+// A skipped frame only leaves its collisions behind (frameDrawn 0).
+int frameValid = 0;
+int frameDrawn;
+int frameEnabled;
+unsigned int frameMode;
+unsigned int frameGeneration;
+unsigned int frameCollisions[8]; // bits or'ed into 0x18-0x1F by the last frame
+
+int STICFrameChanged = 1;
+int STICSkipFrame = 0;
+
+// Deferred rendering (STICDeferred): STICDrawFrame only finds the collisions
+// and snapshots what the pixels are drawn from, STICDrawDeferred draws them
+// into STICDeferredFrame later, on the render thread.  The drawing state
+// belongs to that thread until STICSync returns, STICDrawFrame calls it first.
+struct STICSnapshot {
+    unsigned int memory[0x3A00]; // STIC registers, BACKTAB, GROM and GRAM at their addresses
+    unsigned int gram[64];       // GRAMGeneration
+    unsigned int mode;
+    int enabled;
+};
+
+struct STICSnapshot Snapshot;
+unsigned int STICDeferredFrame[352*224];
+int STICDeferred = 0;
+int STICDeferredPending = 0;
+void (*STICSync)(void) = NULL;
+
+// Incremental rendering (STICIncremental): the frame is drawn a card row at
+// a time, at the STIC phase that fetches the row (STICDrawPhase), from the
+// registers and BACKTAB as they are then; STICDrawFrame only finishes it.
+// A segment remembers what it was drawn from like the whole frame does, and
+// is kept while that is unchanged.
+struct STICSegment {
+    int valid;
+    int drawn;          // pixels, not just collisions
+    int first;          // lines first to last-1
+    int last;
+    unsigned int mode;
+    unsigned int generation;
+    unsigned int csp;   // CSP before and after the segment
+    unsigned int cspOut;
+    unsigned int collisions[8];
+};
+
+struct STICSegment Segments[13];
+int STICIncremental = 0;
+int segmentNext = -1;   // next segment of the frame, -1 before it started
+int segmentLine;        // first line of the next segment
+int segmentsChanged;    // a segment of this frame was drawn
+
+// MOBs decoded once per frame by decodeMOBs, MOBActive has bit i set on
+// the lines MOB i covers; drawSprites only looks at those
+struct MOBDescriptor {
+    int x;              // first pixel on the half-line
+    int top;            // first line (drawSprites numbering)
+    int sizeX;          // 0-normal, 1-double width
+    int interactive;
+    int visible;
+    int priority;       // 0-normal, 1-behind background cards
+    unsigned int fgcolor;       // color index
+    unsigned char rows[64][2]; // graphic byte of each line, for both half-lines, flipped
+};
+
+struct MOBDescriptor MOBs[8];
+unsigned char MOBActive[105];
+
+// The STIC draws color indices, these give their RGB values when the frame
+// is converted for output (STICConvertFrame)
 unsigned int colors[16] =
 {
 	0x0C0005, /* 0x000000; */ // Black
@@ -99,7 +181,6 @@ unsigned int colors[16] =
 	0x6CCD30, /* 0x7FFF00; */ // Bright green
 	0xC81A7D  /* 0xFF007F; */ // Magenta
 };
-#endif
 
 int reverse[256] = // lookup table to reverse the bits in a byte //
 {
@@ -121,8 +202,471 @@ int reverse[256] = // lookup table to reverse the bits in a byte //
 	0x0F, 0x8F, 0x4F, 0xCF, 0x2F, 0xAF, 0x6F, 0xEF, 0x1F, 0x9F, 0x5F, 0xDF, 0x3F, 0xBF, 0x7F, 0xFF
 };
 
+// Row kernels: turn one byte of card or MOB graphic into 8 pixels.
+// expandRow draws a background card row (set bits fg, clear bits bg) and
+// sets its bits in the background collision mask in the same pass,
+// blendRow draws the set bits of a MOB row over the scanline, blendRow2x
+// the same doubled to 16 pixels for double width MOBs.  Pixels are color
+// index bytes, so the scalar versions blend a row as one 64 bit word:
+// byteMask spreads the graphic byte to a mask of whole bytes.  The vector
+// versions test the byte against a bit per lane instead; STICReset picks
+// them when the cpu has them, they give the same result.
+uint64_t byteMask[256];
+
+void buildByteMask(void)
+{
+    unsigned char m[8];
+    int g, i;
+
+    for (g = 0; g < 256; g++)
+    {
+        for (i = 0; i < 8; i++)
+            m[i] = ((g >> (7-i)) & 1) ? 0xFF : 0x00;
+        memcpy(&byteMask[g], m, 8);
+    }
+}
+
+void expandRowScalar(unsigned char *line, uint64_t *coll, int x, int gdata, unsigned int fg, unsigned int bg)
+{
+    uint64_t mask = byteMask[gdata];
+    uint64_t row = (mask & (fg * 0x0101010101010101ULL)) | (~mask & (bg * 0x0101010101010101ULL));
+
+    memcpy(&line[x], &row, 8);
+    collSet(coll, x, reverse[gdata], 8);
+}
+
+void blendRowScalar(unsigned char *dst, int gdata, unsigned int fg)
+{
+    uint64_t mask = byteMask[gdata];
+    uint64_t row;
+
+    memcpy(&row, dst, 8);
+    row = (mask & (fg * 0x0101010101010101ULL)) | (~mask & row);
+    memcpy(dst, &row, 8);
+}
+
+void blendRow2xScalar(unsigned char *dst, int gdata, unsigned int fg)
+{
+    gdata = spreadBits(gdata);
+    blendRowScalar(dst, gdata >> 8, fg);
+    blendRowScalar(dst + 8, gdata & 0xFF, fg);
+}
+
+// Output conversion: frameNative has 176 color indices a line, the output
+// 352 pixels, every index doubled.  The palette is built from colors[] for
+// each conversion, the vector versions look it up with a byte shuffle, 16
+// pixels at a time.  STICReset picks the best one the cpu supports, all of
+// them give the same result as the scalar ones.  count is the number of
+// indices, a multiple of 16: the frame, or one line for a padded output.
+void convert32Scalar(unsigned int *dst, const unsigned char *src, const unsigned int *palette, int count)
+{
+    int i;
+    unsigned int c;
+
+    for (i = 0; i < count; i++, dst += 2) {
+        c = palette[src[i]];
+        dst[0] = c;
+        dst[1] = c;
+    }
+}
+
+void convert16Scalar(unsigned short *dst, const unsigned char *src, const unsigned short *palette, int count)
+{
+    int i;
+    unsigned short c;
+
+    for (i = 0; i < count; i++, dst += 2) {
+        c = palette[src[i]];
+        dst[0] = c;
+        dst[1] = c;
+    }
+}
+
+// every index four times, for the dual-screen workspace (STICConvertFrame2x)
+void convert32x4Scalar(unsigned int *dst, const unsigned char *src, const unsigned int *palette, int count)
+{
+    int i;
+    unsigned int c;
+
+    for (i = 0; i < count; i++, dst += 4) {
+        c = palette[src[i]];
+        dst[0] = c;
+        dst[1] = c;
+        dst[2] = c;
+        dst[3] = c;
+    }
+}
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define STIC_SSSE3
+#include <tmmintrin.h>
+
+// one table per byte of the output pixel (lowest first), indexed by color
+__attribute__((target("ssse3")))
+void convert32SSSE3(unsigned int *dst, const unsigned char *src, const unsigned int *palette, int count)
+{
+    unsigned char planes[4][16];
+    __m128i t0, t1, t2, t3, idx, b0, b1, b2, b3, lo, hi, lo2, hi2, p[4];
+    int i, j, k;
+
+    for (j = 0; j < 4; j++)
+        for (k = 0; k < 16; k++)
+            planes[j][k] = palette[k] >> (8*j);
+    t0 = _mm_loadu_si128((const __m128i *)planes[0]);
+    t1 = _mm_loadu_si128((const __m128i *)planes[1]);
+    t2 = _mm_loadu_si128((const __m128i *)planes[2]);
+    t3 = _mm_loadu_si128((const __m128i *)planes[3]);
+
+    for (i = 0; i < count; i += 16, dst += 32) {
+        idx = _mm_loadu_si128((const __m128i *)&src[i]);
+        b0 = _mm_shuffle_epi8(t0, idx);
+        b1 = _mm_shuffle_epi8(t1, idx);
+        b2 = _mm_shuffle_epi8(t2, idx);
+        b3 = _mm_shuffle_epi8(t3, idx);
+        lo = _mm_unpacklo_epi8(b0, b1);
+        hi = _mm_unpackhi_epi8(b0, b1);
+        lo2 = _mm_unpacklo_epi8(b2, b3);
+        hi2 = _mm_unpackhi_epi8(b2, b3);
+        p[0] = _mm_unpacklo_epi16(lo, lo2); // pixels 0-3
+        p[1] = _mm_unpackhi_epi16(lo, lo2);
+        p[2] = _mm_unpacklo_epi16(hi, hi2);
+        p[3] = _mm_unpackhi_epi16(hi, hi2);
+        for (j = 0; j < 4; j++) {
+            _mm_storeu_si128((__m128i *)&dst[8*j], _mm_unpacklo_epi32(p[j], p[j]));
+            _mm_storeu_si128((__m128i *)&dst[8*j + 4], _mm_unpackhi_epi32(p[j], p[j]));
+        }
+    }
+}
+
+__attribute__((target("ssse3")))
+void convert16SSSE3(unsigned short *dst, const unsigned char *src, const unsigned short *palette, int count)
+{
+    unsigned char planes[2][16];
+    __m128i t0, t1, idx, b0, b1, p[2];
+    int i, j, k;
+
+    for (j = 0; j < 2; j++)
+        for (k = 0; k < 16; k++)
+            planes[j][k] = palette[k] >> (8*j);
+    t0 = _mm_loadu_si128((const __m128i *)planes[0]);
+    t1 = _mm_loadu_si128((const __m128i *)planes[1]);
+
+    for (i = 0; i < count; i += 16, dst += 32) {
+        idx = _mm_loadu_si128((const __m128i *)&src[i]);
+        b0 = _mm_shuffle_epi8(t0, idx);
+        b1 = _mm_shuffle_epi8(t1, idx);
+        p[0] = _mm_unpacklo_epi8(b0, b1); // pixels 0-7
+        p[1] = _mm_unpackhi_epi8(b0, b1);
+        for (j = 0; j < 2; j++) {
+            _mm_storeu_si128((__m128i *)&dst[16*j], _mm_unpacklo_epi16(p[j], p[j]));
+            _mm_storeu_si128((__m128i *)&dst[16*j + 8], _mm_unpackhi_epi16(p[j], p[j]));
+        }
+    }
+}
+
+// a pixel broadcast to a whole vector is four of it
+__attribute__((target("ssse3")))
+void convert32x4SSSE3(unsigned int *dst, const unsigned char *src, const unsigned int *palette, int count)
+{
+    unsigned char planes[4][16];
+    __m128i t0, t1, t2, t3, idx, b0, b1, b2, b3, lo, hi, lo2, hi2, p[4];
+    int i, j, k;
+
+    for (j = 0; j < 4; j++)
+        for (k = 0; k < 16; k++)
+            planes[j][k] = palette[k] >> (8*j);
+    t0 = _mm_loadu_si128((const __m128i *)planes[0]);
+    t1 = _mm_loadu_si128((const __m128i *)planes[1]);
+    t2 = _mm_loadu_si128((const __m128i *)planes[2]);
+    t3 = _mm_loadu_si128((const __m128i *)planes[3]);
+
+    for (i = 0; i < count; i += 16, dst += 64) {
+        idx = _mm_loadu_si128((const __m128i *)&src[i]);
+        b0 = _mm_shuffle_epi8(t0, idx);
+        b1 = _mm_shuffle_epi8(t1, idx);
+        b2 = _mm_shuffle_epi8(t2, idx);
+        b3 = _mm_shuffle_epi8(t3, idx);
+        lo = _mm_unpacklo_epi8(b0, b1);
+        hi = _mm_unpackhi_epi8(b0, b1);
+        lo2 = _mm_unpacklo_epi8(b2, b3);
+        hi2 = _mm_unpackhi_epi8(b2, b3);
+        p[0] = _mm_unpacklo_epi16(lo, lo2); // pixels 0-3
+        p[1] = _mm_unpackhi_epi16(lo, lo2);
+        p[2] = _mm_unpacklo_epi16(hi, hi2);
+        p[3] = _mm_unpackhi_epi16(hi, hi2);
+        for (j = 0; j < 4; j++) {
+            _mm_storeu_si128((__m128i *)&dst[16*j], _mm_shuffle_epi32(p[j], 0x00));
+            _mm_storeu_si128((__m128i *)&dst[16*j + 4], _mm_shuffle_epi32(p[j], 0x55));
+            _mm_storeu_si128((__m128i *)&dst[16*j + 8], _mm_shuffle_epi32(p[j], 0xAA));
+            _mm_storeu_si128((__m128i *)&dst[16*j + 12], _mm_shuffle_epi32(p[j], 0xFF));
+        }
+    }
+}
+#endif
+
+#if (defined(__ARM_NEON) || defined(__ARM_NEON__)) && !defined(__ARM_BIG_ENDIAN)
+#define STIC_NEON
+#include <arm_neon.h>
+
+uint8x16_t lookupNEON(uint8x16_t table, uint8x16_t idx)
+{
+#if defined(__aarch64__)
+    return vqtbl1q_u8(table, idx);
+#else
+    uint8x8x2_t t;
+
+    t.val[0] = vget_low_u8(table);
+    t.val[1] = vget_high_u8(table);
+    return vcombine_u8(vtbl2_u8(t, vget_low_u8(idx)), vtbl2_u8(t, vget_high_u8(idx)));
+#endif
+}
+
+// vst4q/vst2q interleave the byte planes into pixels, zipping a plane with
+// itself doubles them
+void convert32NEON(unsigned int *dst, const unsigned char *src, const unsigned int *palette, int count)
+{
+    unsigned char planes[4][16];
+    uint8x16_t t[4], idx;
+    uint8x16x2_t d[4];
+    uint8x16x4_t out;
+    int i, j, k;
+
+    for (j = 0; j < 4; j++)
+    {
+        for (k = 0; k < 16; k++)
+            planes[j][k] = palette[k] >> (8*j);
+        t[j] = vld1q_u8(planes[j]);
+    }
+
+    for (i = 0; i < count; i += 16, dst += 32) {
+        idx = vld1q_u8(&src[i]);
+        for (j = 0; j < 4; j++) {
+            uint8x16_t b = lookupNEON(t[j], idx);
+            d[j] = vzipq_u8(b, b);
+        }
+        for (k = 0; k < 2; k++) {
+            for (j = 0; j < 4; j++)
+                out.val[j] = d[j].val[k];
+            vst4q_u8((uint8_t *)&dst[16*k], out);
+        }
+    }
+}
+
+void convert16NEON(unsigned short *dst, const unsigned char *src, const unsigned short *palette, int count)
+{
+    unsigned char planes[2][16];
+    uint8x16_t t[2], idx;
+    uint8x16x2_t d[2];
+    uint8x16x2_t out;
+    int i, j, k;
+
+    for (j = 0; j < 2; j++)
+    {
+        for (k = 0; k < 16; k++)
+            planes[j][k] = palette[k] >> (8*j);
+        t[j] = vld1q_u8(planes[j]);
+    }
+
+    for (i = 0; i < count; i += 16, dst += 32) {
+        idx = vld1q_u8(&src[i]);
+        for (j = 0; j < 2; j++) {
+            uint8x16_t b = lookupNEON(t[j], idx);
+            d[j] = vzipq_u8(b, b);
+        }
+        for (k = 0; k < 2; k++) {
+            out.val[0] = d[0].val[k];
+            out.val[1] = d[1].val[k];
+            vst2q_u8((uint8_t *)&dst[16*k], out);
+        }
+    }
+}
+
+// zipping twice makes four of every pixel
+void convert32x4NEON(unsigned int *dst, const unsigned char *src, const unsigned int *palette, int count)
+{
+    unsigned char planes[4][16];
+    uint8x16_t t[4], idx;
+    uint8x16x2_t d[4][2];
+    uint8x16x4_t out;
+    int i, j, k;
+
+    for (j = 0; j < 4; j++)
+    {
+        for (k = 0; k < 16; k++)
+            planes[j][k] = palette[k] >> (8*j);
+        t[j] = vld1q_u8(planes[j]);
+    }
+
+    for (i = 0; i < count; i += 16, dst += 64) {
+        idx = vld1q_u8(&src[i]);
+        for (j = 0; j < 4; j++) {
+            uint8x16_t b = lookupNEON(t[j], idx);
+            uint8x16x2_t z = vzipq_u8(b, b);
+            d[j][0] = vzipq_u8(z.val[0], z.val[0]);
+            d[j][1] = vzipq_u8(z.val[1], z.val[1]);
+        }
+        for (k = 0; k < 4; k++) {
+            for (j = 0; j < 4; j++)
+                out.val[j] = d[j][k >> 1].val[k & 1];
+            vst4q_u8((uint8_t *)&dst[16*k], out);
+        }
+    }
+}
+#endif
+
+#if defined(STIC_SSSE3)
+#define STIC_SSE2
+
+// the lane mask gives the collision bits back with one movemask
+__attribute__((target("sse2")))
+void expandRowSSE2(unsigned char *line, uint64_t *coll, int x, int gdata, unsigned int fg, unsigned int bg)
+{
+    __m128i bits = _mm_setr_epi8((char)0x80, 0x40, 0x20, 0x10, 0x08, 0x04, 0x02, 0x01, 0, 0, 0, 0, 0, 0, 0, 0);
+    __m128i mask = _mm_cmpeq_epi8(_mm_and_si128(_mm_set1_epi8(gdata), bits), bits);
+
+    _mm_storel_epi64((__m128i *)&line[x], _mm_or_si128(_mm_and_si128(mask, _mm_set1_epi8(fg)), _mm_andnot_si128(mask, _mm_set1_epi8(bg))));
+    collSet(coll, x, _mm_movemask_epi8(mask) & 0xFF, 8);
+}
+
+__attribute__((target("sse2")))
+void blendRowSSE2(unsigned char *dst, int gdata, unsigned int fg)
+{
+    __m128i bits = _mm_setr_epi8((char)0x80, 0x40, 0x20, 0x10, 0x08, 0x04, 0x02, 0x01, 0, 0, 0, 0, 0, 0, 0, 0);
+    __m128i mask = _mm_cmpeq_epi8(_mm_and_si128(_mm_set1_epi8(gdata), bits), bits);
+    __m128i row = _mm_loadl_epi64((const __m128i *)dst);
+
+    _mm_storel_epi64((__m128i *)dst, _mm_or_si128(_mm_and_si128(mask, _mm_set1_epi8(fg)), _mm_andnot_si128(mask, row)));
+}
+
+__attribute__((target("sse2")))
+void blendRow2xSSE2(unsigned char *dst, int gdata, unsigned int fg)
+{
+    __m128i bits = _mm_setr_epi8((char)0x80, (char)0x80, 0x40, 0x40, 0x20, 0x20, 0x10, 0x10, 0x08, 0x08, 0x04, 0x04, 0x02, 0x02, 0x01, 0x01);
+    __m128i mask = _mm_cmpeq_epi8(_mm_and_si128(_mm_set1_epi8(gdata), bits), bits);
+    __m128i row = _mm_loadu_si128((const __m128i *)dst);
+
+    _mm_storeu_si128((__m128i *)dst, _mm_or_si128(_mm_and_si128(mask, _mm_set1_epi8(fg)), _mm_andnot_si128(mask, row)));
+}
+#endif
+
+#if defined(STIC_NEON)
+const uint8_t rowBits[8] = { 0x80, 0x40, 0x20, 0x10, 0x08, 0x04, 0x02, 0x01 };
+const uint8_t rowBits2x[16] = { 0x80, 0x80, 0x40, 0x40, 0x20, 0x20, 0x10, 0x10, 0x08, 0x08, 0x04, 0x04, 0x02, 0x02, 0x01, 0x01 };
+
+// NEON has no movemask, the collision bits come from the table
+void expandRowNEON(unsigned char *line, uint64_t *coll, int x, int gdata, unsigned int fg, unsigned int bg)
+{
+    uint8x8_t mask = vtst_u8(vdup_n_u8(gdata), vld1_u8(rowBits));
+
+    vst1_u8(&line[x], vbsl_u8(mask, vdup_n_u8(fg), vdup_n_u8(bg)));
+    collSet(coll, x, reverse[gdata], 8);
+}
+
+void blendRowNEON(unsigned char *dst, int gdata, unsigned int fg)
+{
+    uint8x8_t mask = vtst_u8(vdup_n_u8(gdata), vld1_u8(rowBits));
+
+    vst1_u8(dst, vbsl_u8(mask, vdup_n_u8(fg), vld1_u8(dst)));
+}
+
+void blendRow2xNEON(unsigned char *dst, int gdata, unsigned int fg)
+{
+    uint8x16_t mask = vtstq_u8(vdupq_n_u8(gdata), vld1q_u8(rowBits2x));
+
+    vst1q_u8(dst, vbslq_u8(mask, vdupq_n_u8(fg), vld1q_u8(dst)));
+}
+#endif
+
+void (*expandRow)(unsigned char *line, uint64_t *coll, int x, int gdata, unsigned int fg, unsigned int bg) = expandRowScalar;
+void (*blendRow)(unsigned char *dst, int gdata, unsigned int fg) = blendRowScalar;
+void (*blendRow2x)(unsigned char *dst, int gdata, unsigned int fg) = blendRow2xScalar;
+void (*convert32)(unsigned int *dst, const unsigned char *src, const unsigned int *palette, int count) = convert32Scalar;
+void (*convert16)(unsigned short *dst, const unsigned char *src, const unsigned short *palette, int count) = convert16Scalar;
+void (*convert32x4)(unsigned int *dst, const unsigned char *src, const unsigned int *palette, int count) = convert32x4Scalar;
+
+void selectKernels(void)
+{
+    buildByteMask();
+    expandRow = expandRowScalar;
+    blendRow = blendRowScalar;
+    blendRow2x = blendRow2xScalar;
+    convert32 = convert32Scalar;
+    convert16 = convert16Scalar;
+    convert32x4 = convert32x4Scalar;
+#if defined(STIC_SSE2)
+    if (__builtin_cpu_supports("sse2"))
+    {
+        expandRow = expandRowSSE2;
+        blendRow = blendRowSSE2;
+        blendRow2x = blendRow2xSSE2;
+    }
+#endif
+#if defined(STIC_SSSE3)
+    if (__builtin_cpu_supports("ssse3"))
+    {
+        convert32 = convert32SSSE3;
+        convert16 = convert16SSSE3;
+        convert32x4 = convert32x4SSSE3;
+    }
+#endif
+#if defined(STIC_NEON)
+    expandRow = expandRowNEON;
+    blendRow = blendRowNEON;
+    blendRow2x = blendRow2xNEON;
+    convert32 = convert32NEON;
+    convert16 = convert16NEON;
+    convert32x4 = convert32x4NEON;
+#endif
+}
+
+// Collision masks: one bit per pixel of a half-line for every source that
+// can collide, numbered like the collision register bits: MOBs 0-7,
+// background cards 8, border 9.  Bit x of a mask is pixel x (word x/64).
+// Only pixels 1-167 count, collideLine ANDs each interactive MOB's mask
+// with the others to find what it touched.
+const uint64_t collRange[3] = { ~1ULL, ~0ULL, (1ULL << 40) - 1 };
+
+// set count (<=16) pixels from x on, bit 0 of bits is pixel x
+void collSet(uint64_t *mask, int x, unsigned int bits, int count)
+{
+    mask[x >> 6] |= (uint64_t)bits << (x & 63);
+    if ((x & 63) + count > 64)
+        mask[(x >> 6) + 1] |= (uint64_t)bits >> (64 - (x & 63));
+}
+
+// get count (<=16) pixels from x on, bit 0 of the result is pixel x
+unsigned int collGet(const uint64_t *mask, int x, int count)
+{
+    uint64_t bits = mask[x >> 6] >> (x & 63);
+
+    if ((x & 63) + count > 64)
+        bits |= mask[(x >> 6) + 1] << (64 - (x & 63));
+    return (unsigned int)bits & ((1 << count) - 1);
+}
+
+// doubles every bit of a byte (double width MOBs), keeps the bit order
+unsigned int spreadBits(unsigned int bits)
+{
+    bits = (bits | (bits << 4)) & 0x0F0F;
+    bits = (bits | (bits << 2)) & 0x3333;
+    bits = (bits | (bits << 1)) & 0x5555;
+    return bits | (bits << 1);
+}
+
+// keeps every other bit of 16 (0, 2, ...), the inverse of spreadBits
+unsigned int evenBits(unsigned int bits)
+{
+    bits &= 0x5555;
+    bits = (bits | (bits >> 1)) & 0x3333;
+    bits = (bits | (bits >> 2)) & 0x0F0F;
+    bits = (bits | (bits >> 4)) & 0x00FF;
+    return bits;
+}
+
 void STICSerialize(struct STICserialized *all)
 {
+    if (STICSync)
+        STICSync();
     all->STICMode = STICMode;
     all->stic_phase = stic_phase;
     all->stic_vid_enable = stic_vid_enable;
@@ -142,6 +686,8 @@ void STICSerialize(struct STICserialized *all)
 
 void STICUnserialize(const struct STICserialized *all)
 {
+    if (STICSync)
+        STICSync();
     STICMode = all->STICMode;
     stic_phase = all->stic_phase;
     stic_vid_enable = all->stic_vid_enable;
@@ -159,8 +705,66 @@ void STICUnserialize(const struct STICserialized *all)
     memcpy(frame, all->frame, sizeof(frame));
 }
 
+void STICFlushCache(void)
+{
+    if (STICSync)
+        STICSync();
+    memset(CardCache, 0, sizeof(CardCache));
+    STICInvalidateFrame();
+}
+
+void STICInvalidateFrame(void)
+{
+    frameValid = 0;
+    memset(Segments, 0, sizeof(Segments));
+}
+
+void STICInvalidateGRAM(int adr)
+{
+    GRAMGeneration[(adr >> 3) & 0x3F]++;
+}
+
+// returns the cache entry for BACKTAB position cell, rebuilding it if the
+// card's graphic, colors or the display mode changed since it was built
+struct CardCacheEntry *cardRows(int cell, int card, int gaddress, unsigned int fgcolor, unsigned int bgcolor)
+{
+    struct CardCacheEntry *entry = &CardCache[cell];
+    unsigned int gram = 0;
+    int j;
+
+    if (card & 0x0800)
+        gram = drawGRAM[(card >> 3) & 0x3F];
+    if (entry->valid && entry->card == card && entry->mode == drawMode && entry->bgcolor == bgcolor && entry->gram == gram)
+        return entry;
+
+    entry->valid = 1;
+    entry->card = card;
+    entry->mode = drawMode;
+    entry->bgcolor = bgcolor;
+    entry->gram = gram;
+    entry->fgcolor = fgcolor;
+    for (j = 0; j < 8; j++)
+        entry->gdata[j] = drawMemory[gaddress + j] & 0xFF;
+    return entry;
+}
+
+// draw one row of a cached card to the scanline, marking its foreground
+// pixels in the background collision mask
+void drawCardRow(struct CardCacheEntry *entry, int cardrow, int x)
+{
+    int gdata = entry->gdata[cardrow];
+
+    // bit 8 - collision bit for Background
+    if (drawPixels)
+        expandRow(scanBuffer, collMask[0][8], x, gdata, entry->fgcolor, entry->bgcolor);
+    else
+        collSet(collMask[0][8], x, reverse[gdata], 8);
+}
+
 void STICReset(void)
 {
+    if (STICSync)
+        STICSync();
 	STICMode = 1;       // Color Stack mode
 	SR1 = 0;            // No interrupt pending
 	DisplayEnabled = 0;
@@ -169,70 +773,61 @@ void STICReset(void)
     stic_reg = 1;
     stic_gram = 1;
     phase_len = 2782;   // Time to run before the first STIC interrupt
+    selectKernels();
 }
 
 void drawBorder(int scanline)
 {
 	int i;
-	int cbit = 1<<9; // bit 9 - border collision 
-	int color = colors[Memory[0x2C] & 0x0f]; // border color
+	int line; // offset of the half-line, the second one only when it's separate
+	uint64_t *coll;
+	int color = drawMemory[0x2C] & 0x0f; // border color
 	
 	if(scanline>=112) { return; }
+	for(line=0; line<=192*halfLines; line+=192)
+	{
+    coll = collMask[line/192][9]; // bit 9 - border collision
     if (scanline == delayV - 1 || scanline == 104 || extendTop != 0 && scanline >= 7 && scanline < 16) {    // Collision border is 1 pixel thick, or 9 if extendTop is set
-        for(i=1 * 2; i < (8 + 160) * 2; i += 2)         // It extends from column -7 to 159
+        for(i=0; i<3; i++)                          // It extends from column -7 to 159
         {
-            collBuffer[i] |= cbit;
-            collBuffer[i+384] |= cbit;
+            coll[i] |= collRange[i];
         }
     } else if (scanline > delayV - 1 && scanline < 104) {   // Left and right side collision border
-        for(i=1 * 2; i < 16+(16*extendLeft); i += 2)                 // Left side from column -7 to -1 (or 7 if extendLeft is set)
-        {
-            collBuffer[i] |= cbit;
-            collBuffer[i+384] |= cbit;
-        }
-        i = (8 + 159) * 2;                              // Right side collision is 1 pixel thick
-        collBuffer[i] |= cbit;
-        collBuffer[i + 384] |= cbit;
+        coll[0] |= (1ULL << (8+(8*extendLeft))) - 2;  // Left side from column -7 to -1 (or 7 if extendLeft is set)
+        collSet(coll, 8 + 159, 1, 1);               // Right side collision is 1 pixel thick
     }
+    if (!drawPixels) { continue; } // collisions only
     if (extendTop != 0)
         i = 16;
     else
         i = delayV;
     if(scanline<i || scanline>=104) // top and bottom border
 	{
-		for(i=0; i<352; i++)
+		for(i=0; i<176; i++)
 		{
-			scanBuffer[i] = color;
-			scanBuffer[i+384] = color;
+			scanBuffer[line+i] = color;
 		}
 	}
 	else // left and right border
 	{
-		for(i=0; i<16+(16*extendLeft); i++)
+		for(i=0; i<8+(8*extendLeft); i++)
 		{
-			scanBuffer[i] = color;
-			scanBuffer[i+168*2] = color;
-			scanBuffer[i+384] = color;
-			scanBuffer[i+384+168*2] = color;
+			scanBuffer[line+i] = color;
+			scanBuffer[line+i+168] = color;
 		}
-        scanBuffer[167*2] = color;                  // Invisible 160th column
-        scanBuffer[167*2 + 1] = color;
-        scanBuffer[167*2 + 384] = color;                  // Invisible 160th column
-        scanBuffer[167*2 + 384 + 1] = color;
+        scanBuffer[line+167] = color;               // Invisible 160th column
     }
+	}
 }
 
 void drawBackgroundFGBG(int scanline)
 {
-	int i; 
 	int row, col; // row offset and column of current card
 	int cardrow;  // which of the 8 rows of the current card to draw
 	int card;     // BACKTAB card info
 	unsigned int bgcolor;
 	unsigned int fgcolor;
 	int gaddress; // card graphic address
-	int gdata;    // current card graphic byte
-	int cbit = 1<<8;   // bit 8 - collision bit for Background
 	int x = delayH; // current pixel offset 
 
 	// Tiled background is 20x12, cards are 8x8
@@ -244,38 +839,16 @@ void drawBackgroundFGBG(int scanline)
 	// Draw cards
 	for (col=0; col<20; col++) // for each card on the current row...
 	{
-		card = Memory[0x200+row+col]; // card info from BACKTAB
+		card = drawMemory[0x200+row+col]; // card info from BACKTAB
 
-		fgcolor = colors[card & 0x07];
-		bgcolor = colors[((card>>9)&0x03) | ((card>>11)&0x04) | ((card>>9)&0x08)]; // bits 12,13,10,9
+		fgcolor = card & 0x07;
+		bgcolor = ((card>>9)&0x03) | ((card>>11)&0x04) | ((card>>9)&0x08); // bits 12,13,10,9
 		
         gaddress = 0x3000 + (card & 0x09f8);
 		
-		gdata = Memory[gaddress + cardrow]; // fetch current line of current card graphic
-
-		for(i=7; i>=0; i--) // draw one line of card graphic
-		{
-			if(((gdata>>i)&1)==1)
-			{
-				// draw pixel
-				scanBuffer[x] = fgcolor;
-				scanBuffer[x+1] = fgcolor;
-				scanBuffer[x+384] = fgcolor;
-				scanBuffer[x+384+1] = fgcolor;
-				// write to collision buffer 
-				collBuffer[x] |= cbit;
-				collBuffer[x+384] |= cbit;
-			}
-			else
-			{
-				// draw background
-				scanBuffer[x] = bgcolor;
-				scanBuffer[x+1] = bgcolor;
-				scanBuffer[x+384] = bgcolor;
-				scanBuffer[x+384+1] = bgcolor;
-			}		
-			x+=2;
-		}
+		// draw one line of card graphic
+		drawCardRow(cardRows(row+col, card, gaddress, fgcolor, bgcolor), cardrow, x);
+		x+=8;
 	}
 }
 
@@ -290,9 +863,7 @@ void drawBackgroundColorStack(int scanline)
     unsigned int bgcolor;
     unsigned int fgcolor;
     int gaddress; // card graphic address
-    int gdata;    // current card graphic byte
     int advcolor; // Flag - Advance CSP
-    int cbit = 1<<8;   // bit 8 - collision bit for Background
     int x = delayH; // current pixel offset
     
     // Tiled background is 20x12, cards are 8x8
@@ -306,14 +877,13 @@ void drawBackgroundColorStack(int scanline)
     // Draw cards
     for (col=0; col<20; col++) // for each card on the current row...
     {
-        card = Memory[0x200+row+col]; // card info from BACKTAB
+        card = drawMemory[0x200+row+col]; // card info from BACKTAB
         
         if(((card>>11)&0x03)==2) // Color Squares Mode
         {
             if (cardrow == 0)
-                bgcard[col] = colors[Memory[CSP] & 0x0F];
+                bgcard[col] = drawMemory[CSP] & 0x0F;
             // set colors
-            colors[7] = bgcard[col]; // color 7 is top of color stack
             color1 = card & 0x07;
             color2 = (card>>3) & 0x07;
             if(cardrow>=4) // switch to lower squares colors
@@ -321,30 +891,17 @@ void drawBackgroundColorStack(int scanline)
                 color1 = (card>>6) & 0x07;	                 // color 3
                 color2 = ((card>>11)&0x04)|((card>>9)&0x03); // color 4
             }
-            // color 7 does not interact with sprites
-            cbit1 = cbit2 = cbit;
-            if(color1==7) { cbit1=0; }
-            if(color2==7) { cbit2=0; }
-            color1 = colors[color1]; // set to rgb24 color
-            color2 = colors[color2];
-            colors[7] = color7; // restore color 7
+            // color 7 is top of color stack, and does not interact with sprites
+            cbit1 = cbit2 = 0x0F;
+            if(color1==7) { cbit1=0; color1 = bgcard[col]; }
+            if(color2==7) { cbit2=0; color2 = bgcard[col]; }
             // draw squares
-            for(i=0; i<8; i += 2)
+            for(i=0; i<4 && drawPixels; i++)
             {
-                scanBuffer[x] = color1;
-                scanBuffer[x+1] = color1;
-                scanBuffer[x+8] = color2;
-                scanBuffer[x+9] = color2;
-                scanBuffer[x+384] = color1;
-                scanBuffer[x+384+1] = color1;
-                scanBuffer[x+384+8] = color2;
-                scanBuffer[x+384+9] = color2;
-                collBuffer[x] |= cbit1;
-                collBuffer[x+8] |= cbit2;
-                collBuffer[x+384] |= cbit1;
-                collBuffer[x+384+8] |= cbit2;
-                x+=2;
+                scanBuffer[x+i] = color1;
+                scanBuffer[x+4+i] = color2;
             }
+            collSet(collMask[0][8], x, cbit1 | (cbit2 << 4), 8); // bit 8 - collision bit for Background
             x+=8;
             
         }
@@ -354,8 +911,8 @@ void drawBackgroundColorStack(int scanline)
             {
                 advcolor = (card>>13) & 0x01; // do we need to advance the CSP?
                 CSP = (CSP+advcolor) & 0x2B; // cycles through 0x28-0x2B
-                fgcard[col] = colors[(card&0x07)|((card>>9)&0x08)]; // bits 12, 2, 1, 0
-                bgcard[col] = colors[Memory[CSP] & 0x0F];
+                fgcard[col] = (card&0x07)|((card>>9)&0x08); // bits 12, 2, 1, 0
+                bgcard[col] = drawMemory[CSP] & 0x0F;
             }
             
             fgcolor = fgcard[col];
@@ -366,63 +923,39 @@ void drawBackgroundColorStack(int scanline)
             else
                 gaddress = 0x3000 + (card & 0x0ff8);
             
-            gdata = Memory[gaddress + cardrow]; // fetch current line of current card graphic
-            for(i=7; i>=0; i--) // draw one line of card graphic
-            {
-                if(((gdata>>i)&1)==1)
-                {
-                    // draw pixel
-                    scanBuffer[x] = fgcolor;
-                    scanBuffer[x+1] = fgcolor;
-                    scanBuffer[x+384] = fgcolor;
-                    scanBuffer[x+384+1] = fgcolor;
-                    // write to collision buffer 
-                    collBuffer[x] |= cbit;
-                    collBuffer[x+384] |= cbit;
-                }
-                else
-                {
-                    // draw background
-                    scanBuffer[x] = bgcolor;
-                    scanBuffer[x+1] = bgcolor;
-                    scanBuffer[x+384] = bgcolor;
-                    scanBuffer[x+384+1] = bgcolor;
-                }
-                x+=2;
-            }
+            // draw one line of card graphic
+            drawCardRow(cardRows(row+col, card, gaddress, fgcolor, bgcolor), cardrow, x);
+            x+=8;
         }
     }
 }
 
-void drawSprites(int scanline) // MOBs
+// decode the MOB registers for the frame: position, size, colors and the
+// graphic of every line of each MOB, and which MOBs are on each line
+void decodeMOBs(void)
 {
-	int i, j, k, x;
-	int fgcolor;    // Foreground Color - (Ra bits 12, 2, 1, 0)
+	int i, r;
 	int Rx, Ry, Ra; // sprite/MOB registers
 	int gaddress;   // address of card / sprite data
-	int gdata;      // current byte of sprite data
-	int gdata2;     // current byte of sprite data (second row for half-height sprites)
 	int card;       // card number - Ra bits 10-3
-	int sizeX;      // 0-normal, 1-double width (Rx bit 10)
 	int sizeY;      // 0-half height, 1-normal, 2-double, 3-quadrupal (Ry bits 9, 8)
 	int flipX;      // (Ry bit 10)
 	int flipY;      // (Ry bit 11)
 	int posX;       // (Rx bits 7-0)
 	int posY;       // (Ry bits 6-0)
 	int yRes;       // 0-normal, 1-two tiles high (Ry bit 7)
-	int priority;   // 0-normal, 1-behind background cards (Ra bit 13)
-	int cbit;       // collision bit for collision buffer for collision detection
-
 	int gfxheight;  // sprite is either 8 or 16 bytes (1 or 2 tiles) tall
 	int spriterow;  // row of sprite data to draw
+	int gdata, gdata2;
+	struct MOBDescriptor *mob;
 
-	if(scanline>104) { return; } // one line extra for bottom border collision
+	memset(MOBActive, 0, sizeof(MOBActive));
 
-	for(i=7; i>=0; i--) // draw sprites 0-7 in reverse order
+	for(i=0; i<8; i++)
 	{
-		Rx = Memory[0x00+i]; // 14 bits ; -- -SVI xxxx xxxx ; Size, Visible, Interactive, X Position
-		Ry = Memory[0x08+i]; // 14 bits ; -- YX42 Ryyy yyyy ; Flip Y, Flip X, Size 4, Size 2, Y Resolution, Y Position
-		Ra = Memory[0x10+i]; // 14 bits ; PF Gnnn nnnn nFFF ; Priority, FG Color Bit 3, GRAM, n Card #, FG Color Bits 2-0
+		Rx = drawMemory[0x00+i]; // 14 bits ; -- -SVI xxxx xxxx ; Size, Visible, Interactive, X Position
+		Ry = drawMemory[0x08+i]; // 14 bits ; -- YX42 Ryyy yyyy ; Flip Y, Flip X, Size 4, Size 2, Y Resolution, Y Position
+		Ra = drawMemory[0x10+i]; // 14 bits ; PF Gnnn nnnn nFFF ; Priority, FG Color Bit 3, GRAM, n Card #, FG Color Bits 2-0
 
 		posX  = Rx & 0xFF;
 		posY  = Ry & 0x7F;
@@ -431,7 +964,7 @@ void drawSprites(int scanline) // MOBs
 		// if it's not visible and not interactive, it's disabled
 		if(posX==0 || posX>167 || ((Rx>>8)&0x03)==0 || posY>104) { continue; }
 
-        cbit = 1<<i; // set collision bit
+		mob = &MOBs[i];
 
         card = Ra & 0x0ff8;
         yRes  = (Ry>>7) & 0x01;
@@ -442,25 +975,31 @@ void drawSprites(int scanline) // MOBs
         }
 
         // Limit card number to 64 if in GRAM or in Foreground/Background mode
-        if(STICMode==0 || ((Ra>>11) & 0x01) == 1) { card = card & 0x09f8; }
+        if(drawMode==0 || ((Ra>>11) & 0x01) == 1) { card = card & 0x09f8; }
         gaddress = 0x3000 + card;
         
-        fgcolor = colors[((Ra>>9)&0x08)|(Ra&0x07)];
-        sizeX = (Rx>>10) & 0x01;
+        mob->fgcolor = ((Ra>>9)&0x08)|(Ra&0x07);
+        mob->sizeX = (Rx>>10) & 0x01;
+        mob->interactive = (Rx>>8) & 0x01;
+        mob->visible = (Rx>>9) & 0x01;
+        mob->priority = (Ra>>13) & 0x01;
+        mob->x = (delayH-8) + posX;
+        mob->top = posY;
         sizeY = (Ry>>8) & 0x03;
         flipX = (Ry>>10) & 0x01;
         flipY = (Ry>>11) & 0x01;
-        priority = (Ra>>13) & 0x01;
         
         // sprite height varies by sizeY and yRes.  When yRes is set, the size doubles.
 		// sizeY will be 0,1,2,3, corresponding to heights of 4,8, 16, and 32
 		// we can find this by left-shifting 4 by sizeY as 4<<0==4, ..., 4<<3==32 
 		gfxheight = (4<<sizeY)<<yRes; // yres=0: 4,8,16,32 ; yres=1: 8,16,32,64
-		
-		if( (scanline>=posY) && (scanline<(posY+gfxheight)) ) // if sprite is on current row
-		{ 	
+
+		for(r=0; r<gfxheight && posY+r<=104; r++) // lines past 104 are never drawn
+		{
+			MOBActive[posY+r] |= 1<<i;
+
 			// find sprite graphics data for current row
-			spriterow = (scanline - posY); 
+			spriterow = r; 
 			if(sizeY==0)
 			{
 				spriterow = spriterow * 2;
@@ -473,15 +1012,13 @@ void drawSprites(int scanline) // MOBs
 			if(flipY)
 			{
 				spriterow = (7+(8*yRes)) - spriterow;
-				gaddress = gaddress + spriterow; 
-				gdata  = Memory[gaddress] & 0xFF;
-				gdata2 = Memory[gaddress - (sizeY==0)] & 0xFF;
+				gdata  = drawMemory[gaddress + spriterow] & 0xFF;
+				gdata2 = drawMemory[gaddress + spriterow - (sizeY==0)] & 0xFF;
 			}
 			else
 			{
-				gaddress = gaddress + spriterow; 
-				gdata  = Memory[gaddress] & 0xFF;
-				gdata2 = Memory[gaddress + (sizeY==0)] & 0xFF;
+				gdata  = drawMemory[gaddress + spriterow] & 0xFF;
+				gdata2 = drawMemory[gaddress + spriterow + (sizeY==0)] & 0xFF;
 			}
 
 			if(flipX)
@@ -489,145 +1026,372 @@ void drawSprites(int scanline) // MOBs
 				gdata  = reverse[gdata];
 				gdata2 = reverse[gdata2];
 			}
+			mob->rows[r][0] = gdata;
+			mob->rows[r][1] = gdata2;
+		}
+	}
+}
 
-			// draw sprite row //
-			x = (delayH-16) + (posX * 2); // pixels are 2x2 to accomodate half-height pixels
+void drawSprites(int scanline) // MOBs
+{
+	int i, j, x;
+	int active;     // MOBs on this line
+	int gdata;      // current byte of sprite data
+	struct MOBDescriptor *mob;
+
+	if(scanline>104) { return; } // one line extra for bottom border collision
 
-			for(j=0; j<2; j++)
+	active = MOBActive[scanline];
+	if(active==0) { return; }
+
+	// only half-height sprites give the second half-line its own pixels
+	for(i=0; i<8; i++)
+	{
+		mob = &MOBs[i];
+		if(((active>>i)&1) && mob->rows[scanline-mob->top][0]!=mob->rows[scanline-mob->top][1]) { halfLines = 1; }
+	}
+
+	if(halfLines) // second half-line starts as a copy of the background
+	{
+		memcpy(&scanBuffer[192], &scanBuffer[0], 192);
+		memcpy(collMask[1][8], collMask[0][8], sizeof(collMask[0][8]));
+	}
+
+	for(i=7; i>=0; i--) // draw sprites 0-7 in reverse order
+	{
+		if(((active>>i)&1)==0) { continue; }
+		mob = &MOBs[i];
+		x = mob->x;
+
+		// draw sprite row //
+		for(j=0; j<1+halfLines; j++)
+		{
+			gdata = mob->rows[scanline-mob->top][j];
+
+			if(mob->sizeX==0)
+			{
+				// set collision mask bits //
+				if(mob->interactive)
+				{
+					collSet(collMask[j][i], x, reverse[gdata], 8);
+				}
+				if(!drawPixels) { continue; }
+				if(mob->priority) // don't draw where sprite is behind background
+				{
+					gdata &= ~reverse[collGet(collMask[j][8], x, 8)];
+				}
+				// draw sprite //
+				if(mob->visible)
+				{
+					blendRow(&scanBuffer[x + 192*j], gdata, mob->fgcolor);
+				}
+			}
+			else // double width
 			{
-				for(k=7; k>=0; k--, x+=2+(2*sizeX))
+				if(mob->interactive)
+				{
+					collSet(collMask[j][i], x, spreadBits(reverse[gdata]), 16);
+				}
+				if(!drawPixels) { continue; }
+				if(mob->priority) // double width pixels look behind the background only at their left half
 				{
-					if(((gdata>>k) & 1)==0) // skip ahead if pixel is not visible
-					{
-						continue;
-					} 
-					
-					// set collision and collision buffer bits //
-					if((Rx>>8)&1) // if sprite is interactive
-					{
-						collBuffer[x] |= cbit;
-						collBuffer[x+2*sizeX] |= cbit; // for double width
-					}
-					
-					if(priority && ((collBuffer[x]>>8)&1)) // don't draw if sprite is behind background
-					{
-						continue;
-					} 
-					
-					// draw sprite //
-					if((Rx>>9)&1) // if sprite is visible
-					{
-						scanBuffer[x] = fgcolor;
-						scanBuffer[x+1] = fgcolor;
-						scanBuffer[x+2*sizeX] = fgcolor; // for double width
-						scanBuffer[x+3*sizeX] = fgcolor;
-					}
-                }
-				gdata = gdata2;  // for second half-pixel row  //
-				x = (delayH-16) + 384 + (posX * 2); // for second half-pixel row //
+					gdata &= ~reverse[evenBits(collGet(collMask[j][8], x, 16))];
+				}
+				if(mob->visible)
+				{
+					blendRow2x(&scanBuffer[x + 192*j], gdata, mob->fgcolor);
+				}
 			}
 		}
 	}
 }
 
-void STICDrawFrame(int enabled)
+// find what each interactive MOB touched on one half-line: a source is
+// hit when its mask shares a pixel with the MOB's, the MOB's register bits
+// go to collisions
+void collideLine(uint64_t (*mask)[4], unsigned int *collisions)
 {
-	int row, offset;
-	int i;
+    int i, j;
+    uint64_t m0, m1, m2;
+    unsigned int hits;
 
-    offset = 0;
-    if (enabled == 0) {
-        for (row = 0; row < 112; row++)
-        {
-            int color = colors[Memory[0x2C] & 0x0f]; // border color
-            
-            for(i=0; i<352; i++)
-            {
-                scanBuffer[i] = color;
-                scanBuffer[i+384] = color;
-            }
-            memcpy(&frame[offset], &scanBuffer[0], 352 * sizeof(unsigned int));
-            memcpy(&frame[offset + 352], &scanBuffer[384], 352 * sizeof(unsigned int));
-            offset += 352 * 2;
+    for (i = 0; i < 8; i++) {
+        m0 = mask[i][0] & collRange[0];
+        m1 = mask[i][1] & collRange[1];
+        m2 = mask[i][2] & collRange[2];
+        if ((m0 | m1 | m2) == 0)
+            continue;
+        hits = 1 << i;
+        for (j = 0; j < 10; j++) {
+            if ((m0 & mask[j][0]) | (m1 & mask[j][1]) | (m2 & mask[j][2]))
+                hits |= 1 << j;
         }
-    } else {
-        extendTop = (Memory[0x32]>>1)&0x01;
-        
-        extendLeft = (Memory[0x32])&0x01;
-        
-        delayV = 8 + ((Memory[0x31])&0x7);
-        delayH = 8 + ((Memory[0x30])&0x7);
-        
-        delayH = delayH * 2;
+        collisions[i] |= hits;
+    }
+}
+
+void buildPalettes(int format, unsigned int *palette32, unsigned short *palette16)
+{
+    unsigned int c;
+    int i;
+
+    for (i = 0; i < 16; i++) {
+        c = colors[i];
+        if (format == STIC_XBGR8888)
+            c = ((c & 0xFF) << 16) | (c & 0xFF00) | ((c >> 16) & 0xFF);
+        palette32[i] = c;
+        palette16[i] = ((c >> 8) & 0xF800) | ((c >> 5) & 0x07E0) | ((c >> 3) & 0x001F);
+    }
+}
+
+void STICConvertFrame(void *dst, int pitch, int format)
+{
+    unsigned int palette32[16];
+    unsigned short palette16[16];
+    int i, bytes;
+
+    buildPalettes(format, palette32, palette16);
+    bytes = format == STIC_RGB565 ? sizeof(unsigned short) : sizeof(unsigned int);
+    if (pitch == 352*bytes)
+    {
+        if (format == STIC_RGB565)
+            convert16((unsigned short *)dst, frameNative, palette16, 176*224);
+        else
+            convert32((unsigned int *)dst, frameNative, palette32, 176*224);
+        return;
+    }
+    for (i = 0; i < 224; i++)
+    {
+        if (format == STIC_RGB565)
+            convert16((unsigned short *)((char *)dst + i*pitch), &frameNative[i*176], palette16, 176);
+        else
+            convert32((unsigned int *)((char *)dst + i*pitch), &frameNative[i*176], palette32, 176);
+    }
+}
+
+// frameNative at twice the output size, 704x448, for the dual-screen
+// workspace: each line is converted once and copied to the line below
+void STICConvertFrame2x(unsigned int *dst, int pitch, int format)
+{
+    unsigned int palette32[16];
+    unsigned short palette16[16];
+    unsigned int *line;
+    int i;
+
+    buildPalettes(format, palette32, palette16);
+    for (i = 0; i < 224; i++)
+    {
+        line = (unsigned int *)((char *)dst + 2*i*pitch);
+        convert32x4(line, &frameNative[i*176], palette32, 176);
+        memcpy((char *)line + pitch, line, 704*sizeof(unsigned int));
+    }
+}
+
+void readDisplayRegisters(void)
+{
+    extendTop = (drawMemory[0x32]>>1)&0x01;
+    extendLeft = (drawMemory[0x32])&0x01;
+    delayV = 8 + ((drawMemory[0x31])&0x7);
+    delayH = 8 + ((drawMemory[0x30])&0x7);
+}
+
+// draw lines first to last-1 into frameNative, or-ing the collisions they
+// produce into collisions
+void drawLines(int first, int last, unsigned int *collisions)
+{
+    int row;
+
+    for(row=first; row<last; row++)
+    {
+        memset(collMask, 0, sizeof(collMask));
+        halfLines = 0;
         
-        for(row=0; row<112; row++)
+        // draw backtab
+        if(row>=delayV && row<(96+delayV))
         {
-            memset(&collBuffer[0], 0, sizeof(collBuffer));
-            
-            // draw backtab
-            if(row>=delayV && row<(96+delayV))
+            if(drawMode==0) // Foreground/Background Mode
             {
-                if(STICMode==0) // Foreground/Background Mode
-                {
-                    drawBackgroundFGBG(row-delayV);
-                }
-                else // Color Stack Modes
-                {
-                    drawBackgroundColorStack(row-delayV);
-                }
-            }
-            
-            if (row>=delayV - 1 && row<(97 + delayV)) {
-                // draw MOBs
-                drawSprites((row-delayV)+8);
-            }
-            
-            // draw border and set final collision bits
-            drawBorder(row);
-
-            for (i = 1 * 2; i < 168 * 2; i += 2) {
-                if (collBuffer[i] == 0)
-                    continue;
-                if (collBuffer[i] & 0x01)
-                    Memory[0x18] |= collBuffer[i];
-                if (collBuffer[i] & 0x02)
-                    Memory[0x19] |= collBuffer[i];
-                if (collBuffer[i] & 0x04)
-                    Memory[0x1a] |= collBuffer[i];
-                if (collBuffer[i] & 0x08)
-                    Memory[0x1b] |= collBuffer[i];
-                if (collBuffer[i] & 0x10)
-                    Memory[0x1c] |= collBuffer[i];
-                if (collBuffer[i] & 0x20)
-                    Memory[0x1d] |= collBuffer[i];
-                if (collBuffer[i] & 0x40)
-                    Memory[0x1e] |= collBuffer[i];
-                if (collBuffer[i] & 0x80)
-                    Memory[0x1f] |= collBuffer[i];
+                drawBackgroundFGBG(row-delayV);
             }
-            for (i = 1 * 2 + 384; i < 168 * 2 + 384; i += 2) {
-                if (collBuffer[i] == 0)
-                    continue;
-                if (collBuffer[i] & 0x01)
-                    Memory[0x18] |= collBuffer[i];
-                if (collBuffer[i] & 0x02)
-                    Memory[0x19] |= collBuffer[i];
-                if (collBuffer[i] & 0x04)
-                    Memory[0x1a] |= collBuffer[i];
-                if (collBuffer[i] & 0x08)
-                    Memory[0x1b] |= collBuffer[i];
-                if (collBuffer[i] & 0x10)
-                    Memory[0x1c] |= collBuffer[i];
-                if (collBuffer[i] & 0x20)
-                    Memory[0x1d] |= collBuffer[i];
-                if (collBuffer[i] & 0x40)
-                    Memory[0x1e] |= collBuffer[i];
-                if (collBuffer[i] & 0x80)
-                    Memory[0x1f] |= collBuffer[i];
+            else // Color Stack Modes
+            {
+                drawBackgroundColorStack(row-delayV);
             }
-            memcpy(&frame[offset], &scanBuffer[0], 352 * sizeof(unsigned int));
-            memcpy(&frame[offset + 352], &scanBuffer[384], 352 * sizeof(unsigned int));
-            offset += 352 * 2;
         }
+        
+        if (row>=delayV - 1 && row<(97 + delayV)) {
+            // draw MOBs
+            drawSprites((row-delayV)+8);
+        }
+        
+        // draw border and set final collision bits
+        drawBorder(row);
+
+        // without half-height MOBs both half-lines are the same
+        collideLine(collMask[0], collisions);
+        if (halfLines)
+            collideLine(collMask[1], collisions);
+        if (!drawPixels)
+            continue;
+        memcpy(&frameNative[row * 352], &scanBuffer[0], 176);
+        memcpy(&frameNative[row * 352 + 176], &scanBuffer[192 * halfLines], 176);
+    }
+}
+
+// the live state, for the frame drawn now
+void drawFromMemory(void)
+{
+    drawMemory = Memory;
+    drawGRAM = GRAMGeneration;
+    drawMode = STICMode;
+    drawPixels = !STICSkipFrame && !STICDeferred;
+}
+
+void beginSegments(void)
+{
+    drawFromMemory();
+    readDisplayRegisters();
+    decodeMOBs();
+    segmentNext = 0;
+    segmentLine = 0;
+    segmentsChanged = 0;
+}
+
+// segment 0 is the top border and card row 0, 1-11 the other card rows,
+// 12 the bottom border
+void drawSegment(int k)
+{
+    struct STICSegment *seg = &Segments[k];
+    int first = segmentLine;
+    int last;
+
+    drawFromMemory();
+    readDisplayRegisters();
+    last = k == 12 ? 112 : delayV + 8*k + 8;
+    if (last < first)
+        last = first;
+    segmentLine = last;
+
+    if (seg->valid && (seg->drawn || STICSkipFrame) && seg->first == first && seg->last == last &&
+        seg->mode == STICMode && seg->generation == STICGeneration && seg->csp == CSP) {
+        CSP = seg->cspOut;
+        return;
+    }
+    seg->valid = 1;
+    seg->drawn = !STICSkipFrame;
+    seg->first = first;
+    seg->last = last;
+    seg->mode = STICMode;
+    seg->generation = STICGeneration;
+    seg->csp = CSP;
+    memset(seg->collisions, 0, sizeof(seg->collisions));
+    drawLines(first, last, seg->collisions);
+    seg->cspOut = CSP;
+    segmentsChanged = 1;
+}
+
+void STICDrawPhase(int phase, int enabled)
+{
+    if (enabled == 0 || STICDeferred)
+        return;
+    if (STICSync)
+        STICSync();
+    if (phase == 2)
+        beginSegments();
+    else if (segmentNext < 0)
+        return; // switched on mid-frame, STICDrawFrame draws it all
+    while (segmentNext <= phase - 2 && segmentNext < 13)
+        drawSegment(segmentNext++);
+}
+
+// draw what's left of an incremental frame, set its collisions and convert it
+void finishSegments(void)
+{
+    int i, k;
+
+    if (segmentNext < 0)
+        beginSegments();
+    while (segmentNext < 13)
+        drawSegment(segmentNext++);
+    segmentNext = -1;
+    readDisplayRegisters();
+
+    frameValid = 0; // back to whole frames would have to redraw
+    for (k = 0; k < 13; k++)
+        for (i = 0; i < 8; i++)
+            Memory[0x18 + i] |= Segments[k].collisions[i];
+    STICFrameChanged = segmentsChanged;
+    if (segmentsChanged && !STICSkipFrame)
+        STICConvertFrame(frame, sizeof(unsigned int)*352, STICFrameFormat);
+}
+
+void STICDrawFrame(int enabled)
+{
+	int i;
+
+    if (STICSync)
+        STICSync();
+    drawFromMemory();
+    if (STICIncremental && !STICDeferred && enabled != 0) {
+        finishSegments();
+        return;
+    }
+    if (frameValid && (frameDrawn || STICSkipFrame) && enabled == frameEnabled && STICMode == frameMode && STICGeneration == frameGeneration) {
+        if (enabled != 0) {
+            readDisplayRegisters();
+            for (i = 0; i < 8; i++)
+                Memory[0x18 + i] |= frameCollisions[i];
+        }
+        STICFrameChanged = 0;
+        return;
+    }
+    frameValid = 1;
+    frameDrawn = !STICSkipFrame;
+    frameEnabled = enabled;
+    frameMode = STICMode;
+    frameGeneration = STICGeneration;
+    memset(frameCollisions, 0, sizeof(frameCollisions));
+    memset(Segments, 0, sizeof(Segments)); // frameNative is redrawn under them
+    STICFrameChanged = 1;
+
+    if (enabled != 0) {
+        readDisplayRegisters();
+        decodeMOBs();
+        drawLines(0, 112, frameCollisions);
+        for (i = 0; i < 8; i++)
+            Memory[0x18 + i] |= frameCollisions[i];
+    }
+    if (STICSkipFrame)
+        return;
+    if (STICDeferred) {
+        memcpy(Snapshot.memory, Memory, 0x40 * sizeof(unsigned int)); // STIC registers
+        memcpy(&Snapshot.memory[0x200], &Memory[0x200], 0xF0 * sizeof(unsigned int)); // BACKTAB
+        memcpy(&Snapshot.memory[0x3000], &Memory[0x3000], 0xA00 * sizeof(unsigned int)); // GROM, GRAM
+        memcpy(Snapshot.gram, GRAMGeneration, sizeof(Snapshot.gram));
+        Snapshot.mode = STICMode;
+        Snapshot.enabled = enabled;
+        STICDeferredPending = 1;
+        return;
+    }
+    if (enabled == 0)
+        memset(frameNative, Memory[0x2C] & 0x0f, sizeof(frameNative)); // border color
+    STICConvertFrame(frame, sizeof(unsigned int)*352, STICFrameFormat);
+}
+
+void STICDrawDeferred(void)
+{
+    unsigned int collisions[8] = {0}; // already set by STICDrawFrame
+
+    drawMemory = Snapshot.memory;
+    drawGRAM = Snapshot.gram;
+    drawMode = Snapshot.mode;
+    drawPixels = 1;
+    if (Snapshot.enabled != 0) {
+        readDisplayRegisters();
+        decodeMOBs();
+        drawLines(0, 112, collisions);
+    } else {
+        memset(frameNative, Snapshot.memory[0x2C] & 0x0f, sizeof(frameNative)); // border color
     }
+    STICConvertFrame(STICDeferredFrame, sizeof(unsigned int)*352, STICFrameFormat);
 }
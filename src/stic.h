@@ -30,7 +30,28 @@ extern int delayH;
 
 extern int DisplayEnabled; // determines if frame should be updated or not
 
-extern unsigned int frame[352*224]; // frame buffer
+// pixel formats STICConvertFrame can produce
+#define STIC_XRGB8888 0
+#define STIC_XBGR8888 1 // red and blue swapped (PS2)
+#define STIC_RGB565   2
+
+extern unsigned int frame[352*224]; // frame buffer, in STICFrameFormat
+extern unsigned char frameNative[176*224]; // STIC output at its own resolution: color indices, 176 pixels, two half-lines per scanline
+extern int STICFrameFormat; // STIC_XRGB8888 or STIC_XBGR8888
+
+extern int STICFrameChanged; // 0 when STICDrawFrame reused the previous frame
+extern int STICSkipFrame; // frame won't be shown: STICDrawFrame only sets the collision registers
+extern int STICIncremental; // draw each card row at its STIC phase (STICDrawPhase)
+
+// Deferred rendering for a render thread: STICDrawFrame sets the collisions
+// and leaves a snapshot (STICDeferredPending), STICDrawDeferred draws it into
+// STICDeferredFrame.  STICSync has to wait for STICDrawDeferred to finish,
+// the STIC calls it before it touches its drawing state.
+extern int STICDeferred;
+extern int STICDeferredPending;
+extern unsigned int STICDeferredFrame[352*224];
+extern void (*STICSync)(void);
+void STICDrawDeferred(void);
 
 struct STICserialized {
     unsigned int STICMode;
@@ -60,6 +81,16 @@ void STICSerialize(struct STICserialized *);
 void STICUnserialize(const struct STICserialized *);
 
 void STICDrawFrame(int);
+void STICDrawPhase(int phase, int enabled); // phases 2-14, STICIncremental only
 void STICReset(void);
+void STICConvertFrame(void *dst, int pitch, int format); // frameNative to 352x224 pixels, pitch in bytes
+void STICConvertFrame2x(unsigned int *dst, int pitch, int format); // same at 704x448, 32 bit formats only
+
+// background card cache and last frame: STICInvalidateGRAM is called by
+// the memory bus on GRAM writes, STICFlushCache
+// after Memory is changed behind its back (reset, rom loading, state loading)
+void STICFlushCache(void);
+void STICInvalidateFrame(void); // frame[] was drawn over (OSD), redraw it next time
+void STICInvalidateGRAM(int adr);
 
 #endif